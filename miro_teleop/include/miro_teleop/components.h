@@ -0,0 +1,29 @@
+#ifndef MIRO_TELEOP_COMPONENTS_H
+#define MIRO_TELEOP_COMPONENTS_H
+
+/* Libraries */
+#include "ros/ros.h"
+
+/**
+ * Entry points of the teleoperation nodes, so that they can also be run
+ * together in one process (see teleop_all.cpp).
+ *
+ * Each node source defines its entry point in a namespace of its own, and
+ * a main function (one node per process) unless built with
+ * MIRO_TELEOP_COMPONENT. The handle n is used for topics and services,
+ * pn for the private parameters of the node.
+ *
+ * Servers and the interpreter only set up their callbacks, on the callback
+ * queue of n, and return: someone else spins. Nodes with a control loop
+ * serve their own callback queue from their loop, and run until shutdown.
+ */
+
+namespace gesture_processing { void setup(ros::NodeHandle& n, ros::NodeHandle& pn); }
+namespace pertinence_mapping { void setup(ros::NodeHandle& n, ros::NodeHandle& pn); }
+namespace spatial_reasoner { void setup(ros::NodeHandle& n, ros::NodeHandle& pn); }
+namespace monte_carlo { void setup(ros::NodeHandle& n, ros::NodeHandle& pn); }
+namespace interpreter { void setup(ros::NodeHandle& n, ros::NodeHandle& pn); }
+namespace command_logic { int run(ros::NodeHandle& n, ros::NodeHandle& pn); }
+namespace robot_controller { int run(ros::NodeHandle& n, ros::NodeHandle& pn); }
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef MIRO_TELEOP_FOOTPRINT_H
+#define MIRO_TELEOP_FOOTPRINT_H
+
+/* Libraries */
+#include "miro_teleop/grid.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace miro_teleop {
+
+/**
+ * Axis-aligned rectangle: center and size (in cm), as the obstacles and
+ * the goal region are given to the planner.
+ */
+struct Box
+{
+	double x, y, width, height;
+
+	Box(double x = 0, double y = 0, double width = 0, double height = 0)
+		: x(x), y(y), width(width), height(height) {}
+};
+
+/**
+ * Summed-area table of one layer of a grid.
+ *
+ * Element (I,J) is the sum of the cells i<I, j<J, so that the sum over any
+ * rectangle of cells takes four lookups, whatever its size.
+ */
+struct SummedArea
+{
+	int cols, rows;
+	std::vector<double> sum; // (cols+1) x (rows+1), (I,J) at I+(cols+1)*J
+
+	explicit SummedArea(const Grid<double>& g, int k = 0)
+		: cols(g.cols), rows(g.rows), sum((g.cols+1)*(g.rows+1), 0)
+	{
+		const double* l = g.layer(k);
+		for(int j=0;j<rows;j++)
+		{
+			double row = 0; // Sum of the cells of row j before i
+			for(int i=0;i<cols;i++)
+			{
+				row += l[i+cols*j];
+				sum[i+1+(cols+1)*(j+1)] = sum[i+1+(cols+1)*j]+row;
+			}
+		}
+	}
+
+	/* Sum of the cells i0..i1, j0..j1 (bounds included, clamped) */
+	double box(int i0, int j0, int i1, int j1) const
+	{
+		i0 = i0<0 ? 0 : i0;
+		j0 = j0<0 ? 0 : j0;
+		i1 = i1>=cols ? cols-1 : i1;
+		j1 = j1>=rows ? rows-1 : j1;
+		if(i0>i1 || j0>j1) return 0;
+		const int w = cols+1;
+		return sum[i1+1+w*(j1+1)]-sum[i0+w*(j1+1)]
+		      -sum[i1+1+w*j0]+sum[i0+w*j0];
+	}
+};
+
+/**
+ * Builds the clearance map of a footprint in the workspace.
+ *
+ * Each cell holds the distance (in cm) from the footprint, centered
+ * anywhere in the cell, to the nearest obstacle or wall; it is negative if
+ * the footprint may overlap one. As the boxes are axis-aligned, this is the
+ * distance from the cell center to the obstacles grown by half the
+ * footprint and half a cell.
+ *
+ * @param ws Workspace geometry
+ * @param obstacles Obstacles to keep clear of
+ * @param fw Footprint width (cm)
+ * @param fh Footprint height (cm)
+ * @param C Output, one layer
+ */
+inline void clearanceMap(const Workspace& ws, const std::vector<Box>& obstacles,
+			 double fw, double fh, Grid<double>& C)
+{
+	/* Half extents of the footprint, anywhere in a cell */
+	const double hw = (fw+ws.width/ws.cols)/2;
+	const double hh = (fh+ws.height/ws.rows)/2;
+
+	C.resize(ws.cols, ws.rows);
+	for(int j=0;j<ws.rows;j++)
+	{
+		const double y = ws.y(j);
+		for(int i=0;i<ws.cols;i++)
+		{
+			const double x = ws.x(i);
+
+			/* Walls */
+			double d = ws.width/2-hw-fabs(x);
+			d = fmin(d, ws.height/2-hh-fabs(y));
+
+			/* Obstacles, grown by the footprint */
+			for(int o=0;o<obstacles.size();o++)
+			{
+				const Box& b = obstacles[o];
+				double dx = fabs(x-b.x)-b.width/2-hw;
+				double dy = fabs(y-b.y)-b.height/2-hh;
+				double e = dx<0 && dy<0 ? fmax(dx, dy) :
+					   hypot(fmax(dx, 0), fmax(dy, 0));
+				d = fmin(d, e);
+			}
+			C(i,j) = d;
+		}
+	}
+}
+
+/**
+ * Footprint score of the goal candidates.
+ *
+ * A candidate cell scores the average of the landscape over the cells
+ * covered by the footprint centered on it, or 0 if the footprint is closer
+ * than the minimum clearance to an obstacle or wall. The summed-area table
+ * and the clearance map are built once, then each candidate takes O(1).
+ */
+struct FootprintScore
+{
+	SummedArea area;
+	Grid<double> clearance;
+	int ri, rj; // Footprint half extents (in cells, besides the center)
+	double min_clearance;
+
+	/**
+	 * @param ws Workspace geometry
+	 * @param L Landscape (one layer)
+	 * @param obstacles Obstacles to keep clear of
+	 * @param fw Footprint width (cm), a single cell if smaller
+	 * @param fh Footprint height (cm), likewise
+	 * @param min_clearance Minimum clearance (cm)
+	 */
+	FootprintScore(const Workspace& ws, const Grid<double>& L,
+		       const std::vector<Box>& obstacles, double fw,
+		       double fh, double min_clearance)
+		: area(L), min_clearance(min_clearance)
+	{
+		ri = floor(fw*ws.cols/ws.width/2+0.5);
+		rj = floor(fh*ws.rows/ws.height/2+0.5);
+		clearanceMap(ws, obstacles, fw, fh, clearance);
+	}
+
+	double operator()(int i, int j) const
+	{
+		if(clearance(i,j)<min_clearance) return 0;
+		return area.box(i-ri, j-rj, i+ri, j+rj)/((2*ri+1)*(2*rj+1));
+	}
+
+	/* Scores of all the cells */
+	void map(Grid<double>& S) const
+	{
+		S.resize(clearance.cols, clearance.rows);
+		for(int j=0;j<S.rows;j++)
+			for(int i=0;i<S.cols;i++) S(i,j) = (*this)(i,j);
+	}
+};
+
+/**
+ * Goal candidate: cell and score.
+ */
+struct Candidate
+{
+	int i, j;
+	double score;
+
+	Candidate(int i = 0, int j = 0, double score = 0)
+		: i(i), j(j), score(score) {}
+};
+
+/* Orders candidates from the best score to the worst */
+inline bool betterCandidate(const Candidate& a, const Candidate& b)
+{
+	return a.score>b.score;
+}
+
+/**
+ * Finds the best well-separated goal candidates.
+ *
+ * The peaks of the scores (cells scoring at least the threshold and no less
+ * than their 8 neighbors) are ranked, then kept greedily unless closer than
+ * the separation to one already kept (non-maximum suppression), until k are
+ * kept. Positions given as already kept are taken into account for the
+ * separation, but not returned.
+ *
+ * @param ws Workspace geometry
+ * @param S Footprint scores of the cells (see FootprintScore::map())
+ * @param threshold Minimum score
+ * @param k Maximum number of candidates
+ * @param separation Minimum distance between candidates (cm)
+ * @param kept Positions (in cm) of the goals already kept, x then y
+ * @param out Output, candidates from the best
+ */
+inline void goalCandidates(const Workspace& ws, const Grid<double>& S,
+			   double threshold, int k, double separation,
+			   const std::vector<double>& kept,
+			   std::vector<Candidate>& out)
+{
+	std::vector<Candidate> peaks;
+
+	out.clear();
+	for(int j=0;j<ws.rows;j++)
+		for(int i=0;i<ws.cols;i++)
+		{
+			const double s = S(i,j);
+			bool peak = s>=threshold && s>0;
+			for(int b=-1;b<=1 && peak;b++)
+				for(int a=-1;a<=1 && peak;a++)
+				{
+					int u = i+a, v = j+b;
+					if(u<0 || v<0 || u>=ws.cols || v>=ws.rows)
+						continue;
+					peak = S(u,v)<=s;
+				}
+			if(peak) peaks.push_back(Candidate(i, j, s));
+		}
+	std::sort(peaks.begin(), peaks.end(), betterCandidate);
+
+	const double sep2 = separation*separation;
+	for(int p=0;p<peaks.size() && out.size()<k;p++)
+	{
+		const double x = ws.x(peaks[p].i), y = ws.y(peaks[p].j);
+		bool apart = true;
+		for(int q=0;q+1<kept.size() && apart;q+=2)
+			apart = pow(x-kept[q],2)+pow(y-kept[q+1],2)>=sep2;
+		for(int q=0;q<out.size() && apart;q++)
+			apart = pow(x-ws.x(out[q].i),2)+
+				pow(y-ws.y(out[q].j),2)>=sep2;
+		if(apart) out.push_back(peaks[p]);
+	}
+}
+
+} // namespace miro_teleop
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef MIRO_TELEOP_GRID_H
+#define MIRO_TELEOP_GRID_H
+
+/* Libraries */
+#include "ros/ros.h"
+#include "std_msgs/Float64.h"
+#include <vector>
+#include <cmath>
+
+/* Definitions (defaults of the workspace parameters) */
+#define HSIZE 400 // Horizontal map size (in cm)
+#define VSIZE 400 // Vertical map size (in cm)
+#define RES 40 // Grid resolution (cells per side)
+#define NZ 5 // Number of relations (north, west, south, east, distance-to)
+
+namespace miro_teleop {
+
+/**
+ * Workspace geometry and world-grid transforms.
+ *
+ * The workspace is a width x height rectangle (in cm) centered on the
+ * origin, discretized into cols x rows cells. Cells are addressed by their
+ * column i, along x from -width/2, and their row j, along y from -height/2:
+ * row 0 is the one with the lowest y. This is the layout of the landscapes
+ * sent between the nodes, whatever way they are plotted.
+ *
+ * All the nodes load the geometry from the same parameters at startup (see
+ * load()), so that it can change from one room to another without a
+ * rebuild.
+ */
+struct Workspace
+{
+	double width, height; // Size (in cm)
+	int cols, rows; // Number of cells along x and y
+
+	Workspace(double width = HSIZE, double height = VSIZE,
+		  int cols = RES, int rows = RES)
+		: width(width), height(height), cols(cols), rows(rows) {}
+
+	/**
+	 * Loads the geometry from the parameter server, relative to n:
+	 * workspace/width and workspace/height (cm), workspace/resolution
+	 * (cells per side), or workspace/cols and workspace/rows apart.
+	 * Invalid values are reported and the defaults kept.
+	 */
+	static Workspace load(const ros::NodeHandle& n)
+	{
+		Workspace ws;
+		int res;
+
+		n.param("workspace/width", ws.width, double(HSIZE));
+		n.param("workspace/height", ws.height, double(VSIZE));
+		n.param("workspace/resolution", res, RES);
+		n.param("workspace/cols", ws.cols, res);
+		n.param("workspace/rows", ws.rows, res);
+		if(ws.width<=0 || ws.height<=0 || ws.cols<1 || ws.rows<1)
+		{
+			ROS_ERROR("Invalid workspace %gx%g cm, %dx%d cells: "
+				  "using the defaults", ws.width, ws.height,
+				  ws.cols, ws.rows);
+			return Workspace();
+		}
+		return ws;
+	}
+
+	/* Cell column of a position along x, clamped to the grid */
+	int col(double x) const
+	{
+		int i = floor((x+width/2)*cols/width);
+		return i<0 ? 0 : i>=cols ? cols-1 : i;
+	}
+
+	/* Cell row of a position along y, clamped to the grid */
+	int row(double y) const
+	{
+		int j = floor((y+height/2)*rows/height);
+		return j<0 ? 0 : j>=rows ? rows-1 : j;
+	}
+
+	/* Position along x of the center of column i */
+	double x(int i) const { return width*(i+0.5)/cols-width/2; }
+
+	/* Position along y of the center of row j */
+	double y(int j) const { return height*(j+0.5)/rows-height/2; }
+
+	/* Whether a position lies in the workspace (bounds included) */
+	bool contains(double x, double y) const
+	{
+		return x>=-width/2 && x<=width/2 && y>=-height/2 && y<=height/2;
+	}
+};
+
+/**
+ * Stack of layers of cols x rows cells, stored in one array.
+ *
+ * Element (i,j) of layer k is at i+cols*(j+rows*k): columns first, then
+ * rows, then layers, as in the landscape arrays of the services.
+ */
+template <typename T>
+struct Grid
+{
+	int cols, rows, layers;
+	std::vector<T> data;
+
+	Grid(int cols = 0, int rows = 0, int layers = 1)
+		: cols(cols), rows(rows), layers(layers),
+		  data(cols*rows*layers) {}
+
+	/* Grid covering a workspace */
+	explicit Grid(const Workspace& ws, int layers = 1)
+		: cols(ws.cols), rows(ws.rows), layers(layers),
+		  data(ws.cols*ws.rows*layers) {}
+
+	void resize(int c, int r, int l = 1)
+	{
+		cols = c;
+		rows = r;
+		layers = l;
+		data.resize(c*r*l);
+	}
+
+	int size() const { return data.size(); }
+	int index(int i, int j, int k = 0) const { return i+cols*(j+rows*k); }
+
+	T& operator()(int i, int j, int k = 0) { return data[index(i,j,k)]; }
+	const T& operator()(int i, int j, int k = 0) const
+	{ return data[index(i,j,k)]; }
+
+	/* First element of layer k (rows of cols elements) */
+	T* layer(int k) { return &data[cols*rows*k]; }
+	const T* layer(int k) const { return &data[cols*rows*k]; }
+};
+
+/**
+ * Copies a grid into a message array (same layout).
+ */
+template <typename T>
+void toMsg(const Grid<T>& grid, std::vector<std_msgs::Float64>& msg)
+{
+	msg.resize(grid.size());
+	for(int i=0;i<grid.size();i++) msg[i].data = grid.data[i];
+}
+
+/**
+ * Copies a message array into a grid of the given cols x rows.
+ * The number of layers is taken from the array size.
+ */
+template <typename T>
+void fromMsg(const std::vector<std_msgs::Float64>& msg, int cols, int rows,
+	     Grid<T>& grid)
+{
+	grid.resize(cols, rows, msg.size()/(cols*rows));
+	for(int i=0;i<grid.size();i++) grid.data[i] = msg[i].data;
+}
+
+} // namespace miro_teleop
+
+#endif
@@ -0,0 +1,451 @@
+#ifndef MIRO_TELEOP_LANDSCAPE_H
+#define MIRO_TELEOP_LANDSCAPE_H
+
+/* Libraries */
+#include "miro_teleop/grid.h"
+#include "miro_teleop/morphology.h"
+#include <cmath>
+#include <vector>
+
+namespace miro_teleop {
+
+/* Constants */
+const double LANDSCAPE_PI = 3.14159; // As used to build the landscapes
+
+/**
+ * Grid size known at compile time.
+ * Kernels instantiated with it have constant loop bounds, which the
+ * compiler can unroll and vectorize (resolution-specialized fast paths).
+ */
+template <int COLS, int ROWS>
+struct FixedSize
+{
+	explicit FixedSize(const Workspace&) {}
+	int cols() const { return COLS; }
+	int rows() const { return ROWS; }
+};
+
+/**
+ * Grid size known at run time only (any other resolution).
+ */
+struct RuntimeSize
+{
+	int c, r;
+	explicit RuntimeSize(const Workspace& ws) : c(ws.cols), r(ws.rows) {}
+	int cols() const { return c; }
+	int rows() const { return r; }
+};
+
+/**
+ * Runs the kernel with the fast path matching the workspace
+ * resolution (20, 40 or 80 cells per side), or the generic one.
+ */
+template <class Kernel>
+inline void dispatch(const Workspace& ws, Kernel& kernel)
+{
+	if(ws.cols==RES && ws.rows==RES)
+		kernel.run(FixedSize<RES,RES>(ws));
+	else if(ws.cols==RES/2 && ws.rows==RES/2)
+		kernel.run(FixedSize<RES/2,RES/2>(ws));
+	else if(ws.cols==2*RES && ws.rows==2*RES)
+		kernel.run(FixedSize<2*RES,2*RES>(ws));
+	else
+		kernel.run(RuntimeSize(ws));
+}
+
+/**
+ * Spatial relation kernel, see spatialLandscapes().
+ */
+struct SpatialKernel
+{
+	const Workspace& ws;
+	double xr, yr, a, b;
+	Grid<double>& M;
+
+	SpatialKernel(const Workspace& ws, double xr, double yr,
+		      double a, double b, Grid<double>& M)
+		: ws(ws), xr(xr), yr(yr), a(a), b(b), M(M) {}
+
+	template <class Size>
+	void run(const Size& n)
+	{
+		double xp, yp, xv, yv;
+		double angle, beta_min, beta, dist_min, dist;
+		double c_ang, s_ang; // Store cosines and sines to increase performance
+		std::vector<double> xq(n.cols()), yq(n.rows()); // Obstacle samples
+
+		/* Points of the object, as many as cells in the grid */
+		for(int i=0;i<n.cols();i++) xq[i] = xr-a/2+a*(i/double(n.cols()));
+		for(int j=0;j<n.rows();j++) yq[j] = yr-b/2+b*(j/double(n.rows()));
+
+		/* For every element P=(x,y) of the grid, compute the pertinences */
+		for(int x=0;x<n.cols();x++)
+		{
+			for(int y=0;y<n.rows();y++)
+			{
+				/* Map indices to actual location on the map */
+				xp = ws.x(x);
+				yp = ws.y(y);
+				/* If P is inside the obstacle, pertinences are null */
+				if((xp>(xr-a/2))&&(xp<(xr+a/2))
+				 &&(yp>(yr-b/2))&&(yp<(yr+b/2)))
+				{
+					for(int dir=0;dir<NZ;dir++) M(x,y,dir) = 0;
+					continue;
+				}
+				/* Otherwise, compute with respect to each direction */
+				for(int dir=0;dir<NZ-1;dir++)
+				{
+					angle = dir*LANDSCAPE_PI/2; // Direction angle
+					c_ang = cos(angle);
+					s_ang = sin(angle);
+					beta_min = LANDSCAPE_PI/2; // Initial value of beta
+					dist_min = 1000; // Initial value of distance
+
+					/* For every element of the object calculate */
+					for(int i=0;i<n.cols();i++)
+					{
+						for(int j=0;j<n.rows();j++)
+						{
+							// Compute beta and dist
+							xv = xp-xq[i];
+							yv = yp-yq[j];
+							dist = sqrt(xv*xv+yv*yv);
+							if(dist==0) beta = 0;
+							else beta =
+							acos((xv*c_ang+yv*s_ang)/dist);
+							// Find minimum values
+							if(beta<beta_min) beta_min = beta;
+							if(dist<dist_min) dist_min = dist;
+						}
+					}
+					/* Update matrices with minimum pertinences */
+					M(x,y,dir) =
+					fmax(0,1.0-(2.0*beta_min/LANDSCAPE_PI));
+					/* Update the minimum distance of P to object */
+					M(x,y,NZ-1) =
+					fmin(1,fmax(0,dist_min*exp(-dist_min/60)/20));
+				}
+			}
+		}
+	}
+};
+
+/**
+ * Pertinence mapping kernel, see mapPertinences().
+ *
+ * The landscape is a weighted sum of channels, accumulated one channel at
+ * a time (an AXPY pass each), then normalized by its maximum.
+ */
+struct MappingKernel
+{
+	const double* channels[2*(NZ-1)]; // Channels with a nonzero term
+	double weights[2*(NZ-1)]; // Their weights
+	int terms;
+	Grid<double>& L;
+	double max;
+
+	explicit MappingKernel(Grid<double>& L) : terms(0), L(L), max(0) {}
+
+	/* Adds a term, unless it cannot contribute (null weight or channel) */
+	void add(const double* channel, double weight, double channel_max)
+	{
+		if(weight==0 || channel_max==0) return;
+		channels[terms] = channel;
+		weights[terms] = weight;
+		terms++;
+	}
+
+	template <class Size>
+	void run(const Size& n)
+	{
+		const int cells = n.cols()*n.rows();
+		double* l = &L.data[0];
+		double m = 0;
+
+		for(int c=0;c<cells;c++) l[c] = 0;
+		for(int t=0;t<terms;t++)
+		{
+			const double* ch = channels[t];
+			const double w = weights[t];
+			for(int c=0;c<cells;c++) l[c] += w*ch[c];
+		}
+		for(int c=0;c<cells;c++) m = l[c]>m ? l[c] : m;
+		const double inv = 1/m;
+		for(int c=0;c<cells;c++) l[c] *= inv;
+		max = m;
+	}
+};
+
+/**
+ * Batched pertinence mapping kernel, see mapPertinencesBatch().
+ *
+ * The K landscapes are the product of the channel stack (cells x terms) by
+ * the weights (terms x K), a small GEMM: each cell of the channels is read
+ * once for all the landscapes. Each landscape is then normalized by its
+ * maximum.
+ */
+struct BatchKernel
+{
+	const double* channels[2*(NZ-1)]; // Channels with a nonzero term
+	std::vector<double> weights; // Term t of landscape k at t*K+k
+	int terms, K;
+	Grid<double>& L;
+	std::vector<double> max;
+
+	BatchKernel(int K, Grid<double>& L)
+		: weights(2*(NZ-1)*K), terms(0), K(K), L(L), max(K) {}
+
+	/* Adds a channel with its weight in each landscape, unless it cannot
+	 * contribute to any of them (all weights null, or null channel) */
+	void add(const double* channel, const double* w, double channel_max)
+	{
+		bool used = false;
+		for(int k=0;k<K;k++) used = used || w[k]!=0;
+		if(!used || channel_max==0) return;
+		channels[terms] = channel;
+		for(int k=0;k<K;k++) weights[terms*K+k] = w[k];
+		terms++;
+	}
+
+	template <class Size>
+	void run(const Size& n)
+	{
+		const int cells = n.cols()*n.rows();
+		const double* w = weights.empty() ? 0 : &weights[0];
+		double v[2*(NZ-1)]; // Channels at one cell
+
+		for(int k=0;k<K;k++) max[k] = 0;
+		for(int c=0;c<cells;c++)
+		{
+			for(int t=0;t<terms;t++) v[t] = channels[t][c];
+			for(int k=0;k<K;k++)
+			{
+				double sum = 0;
+				for(int t=0;t<terms;t++) sum += w[t*K+k]*v[t];
+				L.data[c+cells*k] = sum;
+				max[k] = sum>max[k] ? sum : max[k];
+			}
+		}
+		for(int k=0;k<K;k++)
+		{
+			double* l = L.layer(k);
+			const double inv = 1/max[k];
+			for(int c=0;c<cells;c++) l[c] *= inv;
+		}
+	}
+};
+
+/**
+ * Generates the spatial relation landscapes of one rectangular obstacle.
+ *
+ * For each cell P of the workspace, the pertinence of each direction (north,
+ * west, south and east, at 0, 90, 180 and 270 degrees from the x axis) is
+ * 1 minus the smallest angle between that direction and the vector from a
+ * point of the obstacle to P, normalized; the obstacle is sampled with as
+ * many points as the grid has cells. The distance-to landscape peaks at
+ * some distance from the obstacle. All pertinences are null inside it.
+ *
+ * @param ws Workspace geometry
+ * @param xr Obstacle center x
+ * @param yr Obstacle center y
+ * @param a Obstacle width
+ * @param b Obstacle height
+ * @param M Output, NZ layers over the workspace
+ */
+inline void spatialLandscapes(const Workspace& ws, double xr, double yr,
+			      double a, double b, Grid<double>& M)
+{
+	SpatialKernel kernel(ws, xr, yr, a, b, M);
+
+	M.resize(ws.cols, ws.rows, NZ);
+	dispatch(ws, kernel);
+}
+
+/**
+ * Clears the landscapes around the obstacle, up to a margin.
+ *
+ * The landscapes are null inside the obstacle only; this grows the null
+ * region by the margin (e.g. the robot radius), by eroding the mask of the
+ * cells outside the obstacle and applying it to all layers.
+ *
+ * @param ws Workspace geometry
+ * @param xr Obstacle center x
+ * @param yr Obstacle center y
+ * @param a Obstacle width
+ * @param b Obstacle height
+ * @param margin Margin around the obstacle (cm)
+ * @param M Spatial relation landscapes, cleared in place
+ */
+inline void clearMargin(const Workspace& ws, double xr, double yr,
+			double a, double b, double margin, Grid<double>& M)
+{
+	Grid<double> mask(ws);
+	int ri, rj;
+
+	marginCells(ws, margin, ri, rj);
+	if(ri==0 && rj==0) return;
+
+	/* Same inside test as the landscapes */
+	for(int j=0;j<ws.rows;j++)
+		for(int i=0;i<ws.cols;i++)
+		{
+			double xp = ws.x(i), yp = ws.y(j);
+			mask(i,j) = xp>xr-a/2 && xp<xr+a/2 &&
+				    yp>yr-b/2 && yp<yr+b/2 ? 0 : 1;
+		}
+	erode(mask, ri, rj, mask);
+
+	for(int k=0;k<M.layers;k++)
+	{
+		double* l = M.layer(k);
+		for(int c=0;c<ws.cols*ws.rows;c++) l[c] *= mask.data[c];
+	}
+}
+
+/**
+ * Pertinences of the directions at a position (the pointed target).
+ *
+ * @param ws Workspace geometry
+ * @param M Spatial relation landscapes
+ * @param x Target x
+ * @param y Target y
+ * @param gamma Exponent applied to the pertinences
+ * @param P Output, pertinence of each direction
+ */
+inline void targetPertinences(const Workspace& ws, const Grid<double>& M,
+			      double x, double y, double gamma, double P[NZ-1])
+{
+	int i = ws.col(x), j = ws.row(y);
+	for(int dir=0;dir<NZ-1;dir++) P[dir] = pow(M(i,j,dir), gamma);
+}
+
+/**
+ * Premultiplies the direction landscapes by the distance-to landscape.
+ *
+ * Done once per obstacle, so that mapping a target scaled by the distance
+ * is a plain weighted sum of channels. The maxima let the mapping skip the
+ * channels that are null everywhere.
+ *
+ * @param M Spatial relation landscapes
+ * @param Q Output, NZ-1 layers, direction times distance-to landscape
+ * @param maxima Output, maximum of each direction landscape, then of each
+ * premultiplied one
+ */
+inline void premultiply(const Grid<double>& M, Grid<double>& Q,
+			double maxima[2*(NZ-1)])
+{
+	const int cells = M.cols*M.rows;
+	const double* dist = M.layer(NZ-1);
+
+	Q.resize(M.cols, M.rows, NZ-1);
+	for(int dir=0;dir<NZ-1;dir++)
+	{
+		const double* m = M.layer(dir);
+		double* q = Q.layer(dir);
+		double mmax = 0, qmax = 0;
+		for(int c=0;c<cells;c++)
+		{
+			q[c] = m[c]*dist[c];
+			if(m[c]>mmax) mmax = m[c];
+			if(q[c]>qmax) qmax = q[c];
+		}
+		maxima[dir] = mmax;
+		maxima[NZ-1+dir] = qmax;
+	}
+}
+
+/**
+ * Maps the spatial relation landscapes into one, normalized to [0,1].
+ *
+ * Each cell is the sum of the direction landscapes weighted by P, scaled by
+ * the distance-to landscape with weight D (1 fully, 0 not at all), i.e.
+ * the sum of P*(1-D) times the direction channels and P*D times the
+ * premultiplied ones: 4 channels at most in the usual cases (D 1 or 0),
+ * fewer when some weights are null.
+ *
+ * @param ws Workspace geometry (that of the landscapes)
+ * @param M Spatial relation landscapes
+ * @param Q Premultiplied landscapes (see premultiply())
+ * @param maxima Maxima of the channels (see premultiply())
+ * @param P Direction weights
+ * @param D Distance-to weight
+ * @param L Output, mapped landscape (one layer)
+ * @return Maximum before normalization
+ */
+inline double mapPertinences(const Workspace& ws, const Grid<double>& M,
+			     const Grid<double>& Q,
+			     const double maxima[2*(NZ-1)],
+			     const double P[NZ-1], double D, Grid<double>& L)
+{
+	MappingKernel kernel(L);
+
+	for(int dir=0;dir<NZ-1;dir++)
+	{
+		kernel.add(M.layer(dir), P[dir]*(1-D), maxima[dir]);
+		kernel.add(Q.layer(dir), P[dir]*D, maxima[NZ-1+dir]);
+	}
+	L.resize(ws.cols, ws.rows);
+	dispatch(ws, kernel);
+
+	return kernel.max;
+}
+
+/**
+ * Maps the spatial relation landscapes for K targets at once.
+ *
+ * Same as mapPertinences() for each set of direction weights P[k], with the
+ * same distance-to weight, in one pass over the landscapes.
+ *
+ * @param ws Workspace geometry (that of the landscapes)
+ * @param M Spatial relation landscapes
+ * @param Q Premultiplied landscapes (see premultiply())
+ * @param maxima Maxima of the channels (see premultiply())
+ * @param P Direction weights of each target, K*(NZ-1) (target k at k*(NZ-1))
+ * @param D Distance-to weight
+ * @param L Output, K mapped landscapes (one layer each)
+ */
+inline void mapPertinencesBatch(const Workspace& ws, const Grid<double>& M,
+				const Grid<double>& Q,
+				const double maxima[2*(NZ-1)],
+				const std::vector<double>& P, double D,
+				Grid<double>& L)
+{
+	const int K = P.size()/(NZ-1);
+	BatchKernel kernel(K, L);
+	std::vector<double> w(K);
+
+	for(int dir=0;dir<NZ-1;dir++)
+	{
+		for(int k=0;k<K;k++) w[k] = P[k*(NZ-1)+dir]*(1-D);
+		kernel.add(M.layer(dir), &w[0], maxima[dir]);
+		for(int k=0;k<K;k++) w[k] = P[k*(NZ-1)+dir]*D;
+		kernel.add(Q.layer(dir), &w[0], maxima[NZ-1+dir]);
+	}
+	L.resize(ws.cols, ws.rows, K);
+	dispatch(ws, kernel);
+}
+
+/**
+ * Per-cell maximum of the layers of a grid.
+ *
+ * @param L Input, one or more layers
+ * @param out Output, one layer
+ */
+inline void maxLayers(const Grid<double>& L, Grid<double>& out)
+{
+	const int cells = L.cols*L.rows;
+
+	out.resize(L.cols, L.rows);
+	for(int c=0;c<cells;c++) out.data[c] = L.layers>0 ? L.data[c] : 0;
+	for(int k=1;k<L.layers;k++)
+	{
+		const double* l = L.layer(k);
+		for(int c=0;c<cells;c++)
+			out.data[c] = l[c]>out.data[c] ? l[c] : out.data[c];
+	}
+}
+
+} // namespace miro_teleop
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef MIRO_TELEOP_MORPHOLOGY_H
+#define MIRO_TELEOP_MORPHOLOGY_H
+
+/* Libraries */
+#include "miro_teleop/grid.h"
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace miro_teleop {
+
+/**
+ * Morphological operations on landscapes, over (2ri+1) x (2rj+1) boxes of
+ * cells, for safety margins (eroding a landscape by the robot size,
+ * growing obstacles) and smoothing.
+ *
+ * All are separable (rows, then columns) and take constant time per cell
+ * whatever the box size: van Herk/Gil-Werman for erosion and dilation,
+ * running sums for the box filter. Cells outside the grid are ignored, so
+ * that the borders are not eroded nor dilated by the outside. All layers
+ * are processed, and the output may be the input.
+ */
+
+/* Minimum and maximum, the operators of erosion and dilation */
+struct MinOp
+{
+	double operator()(double a, double b) const { return b<a ? b : a; }
+	static double identity() { return std::numeric_limits<double>::infinity(); }
+};
+
+struct MaxOp
+{
+	double operator()(double a, double b) const { return b>a ? b : a; }
+	static double identity() { return -std::numeric_limits<double>::infinity(); }
+};
+
+/**
+ * van Herk/Gil-Werman filter of one line: out[i] is op over in[i-r..i+r].
+ *
+ * The line, padded with r identities each side, is cut into blocks of
+ * 2r+1: g holds the running op from the start of each block, h the one to
+ * its end. Any window spans at most two blocks, so it is op of one value
+ * of each, 3 operations per cell in all.
+ *
+ * @param in First element of the line
+ * @param out First element of the output line (may be in)
+ * @param n Number of elements
+ * @param stride Distance between elements
+ * @param r Window radius
+ * @param g, h Scratch buffers
+ */
+template <class Op>
+void vanHerk(const double* in, double* out, int n, int stride, int r,
+	     std::vector<double>& g, std::vector<double>& h)
+{
+	const Op op = Op();
+	const int w = 2*r+1;
+	const int m = (n+2*r+w-1)/w*w; // Padded length, whole blocks
+
+	g.resize(m);
+	h.resize(m);
+	for(int p=0;p<m;p++)
+	{
+		double v = p>=r && p<r+n ? in[(p-r)*stride] : Op::identity();
+		g[p] = p%w==0 ? v : op(g[p-1], v);
+	}
+	for(int p=m-1;p>=0;p--)
+	{
+		double v = p>=r && p<r+n ? in[(p-r)*stride] : Op::identity();
+		h[p] = p%w==w-1 ? v : op(h[p+1], v);
+	}
+	for(int i=0;i<n;i++) out[i*stride] = op(h[i], g[i+2*r]);
+}
+
+/**
+ * Running sum of one line: out[i] is the sum of in[i-r..i+r] (inside).
+ * Same arguments as vanHerk(), with one scratch buffer.
+ */
+inline void runningSum(const double* in, double* out, int n, int stride,
+		       int r, std::vector<double>& s)
+{
+	s.resize(n+1);
+	s[0] = 0;
+	for(int i=0;i<n;i++) s[i+1] = s[i]+in[i*stride];
+	for(int i=0;i<n;i++)
+	{
+		int lo = i-r<0 ? 0 : i-r, hi = i+r+1>n ? n : i+r+1;
+		out[i*stride] = s[hi]-s[lo];
+	}
+}
+
+/**
+ * Applies a van Herk/Gil-Werman filter to the rows then to the columns.
+ */
+template <class Op>
+void separable(const Grid<double>& in, int ri, int rj, Grid<double>& out)
+{
+	std::vector<double> g, h;
+
+	if(&out!=&in) out = in;
+	for(int k=0;k<out.layers;k++)
+	{
+		double* l = out.layer(k);
+		if(ri>0)
+			for(int j=0;j<out.rows;j++)
+				vanHerk<Op>(l+out.cols*j, l+out.cols*j,
+					    out.cols, 1, ri, g, h);
+		if(rj>0)
+			for(int i=0;i<out.cols;i++)
+				vanHerk<Op>(l+i, l+i, out.rows, out.cols,
+					    rj, g, h);
+	}
+}
+
+/**
+ * Erosion: minimum over the box around each cell.
+ *
+ * @param in Input grid
+ * @param ri Box half width (cells besides the center)
+ * @param rj Box half height (likewise)
+ * @param out Output grid (may be in)
+ */
+inline void erode(const Grid<double>& in, int ri, int rj, Grid<double>& out)
+{
+	separable<MinOp>(in, ri, rj, out);
+}
+
+/**
+ * Dilation: maximum over the box around each cell.
+ * Same arguments as erode().
+ */
+inline void dilate(const Grid<double>& in, int ri, int rj, Grid<double>& out)
+{
+	separable<MaxOp>(in, ri, rj, out);
+}
+
+/**
+ * Box filter: average over the box around each cell (of the cells inside
+ * the grid). Same arguments as erode().
+ */
+inline void boxFilter(const Grid<double>& in, int ri, int rj,
+		      Grid<double>& out)
+{
+	std::vector<double> s;
+
+	if(&out!=&in) out = in;
+	for(int k=0;k<out.layers;k++)
+	{
+		double* l = out.layer(k);
+		for(int j=0;j<out.rows;j++)
+			runningSum(l+out.cols*j, l+out.cols*j, out.cols, 1,
+				   ri, s);
+		for(int i=0;i<out.cols;i++)
+			runningSum(l+i, l+i, out.rows, out.cols, rj, s);
+		/* Cells summed: product of those inside along each axis */
+		for(int j=0;j<out.rows;j++)
+		{
+			int nj = (j+rj<out.rows ? j+rj : out.rows-1)
+				-(j-rj>0 ? j-rj : 0)+1;
+			for(int i=0;i<out.cols;i++)
+			{
+				int ni = (i+ri<out.cols ? i+ri : out.cols-1)
+					-(i-ri>0 ? i-ri : 0)+1;
+				l[i+out.cols*j] /= ni*nj;
+			}
+		}
+	}
+}
+
+/**
+ * Number of cells (besides the center) a distance spans along each axis,
+ * rounded up, to turn a margin in cm into a box radius.
+ *
+ * @param ws Workspace geometry
+ * @param d Distance (cm)
+ * @param ri Output, cells along x
+ * @param rj Output, cells along y
+ */
+inline void marginCells(const Workspace& ws, double d, int& ri, int& rj)
+{
+	ri = d>0 ? ceil(d*ws.cols/ws.width) : 0;
+	rj = d>0 ? ceil(d*ws.rows/ws.height) : 0;
+}
+
+} // namespace miro_teleop
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef MIRO_TELEOP_NAVIGATION_H
+#define MIRO_TELEOP_NAVIGATION_H
+
+/* Libraries */
+#include "miro_teleop/grid.h"
+#include "miro_teleop/footprint.h"
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace miro_teleop {
+
+/**
+ * Navigation function over the workspace grid: cost (travel distance, in
+ * cm) from each cell to a goal region, around the obstacles. Following its
+ * gradient down from any reachable position leads to the goal, without
+ * waypoints.
+ */
+
+/* Cost of a cell already settled by the fast marching, or infinity */
+inline double settledCost(const Grid<double>& T, const std::vector<char>& done,
+			  int i, int j)
+{
+	if(i<0 || j<0 || i>=T.cols || j>=T.rows || !done[T.index(i,j)])
+		return std::numeric_limits<double>::infinity();
+	return T(i,j);
+}
+
+/**
+ * Computes the cost-to-goal field by fast marching.
+ *
+ * The cells whose center lies in the goal region cost 0 (the goal cell if
+ * none does); the cost then spreads out from the cheapest cell settled,
+ * each neighbor solving the eikonal equation |grad T| = 1 from its settled
+ * neighbors, so that costs follow straight-line distances rather than
+ * grid paths. Blocked cells (clearance below 0) are never crossed.
+ *
+ * @param ws Workspace geometry
+ * @param clearance Clearance map of the robot footprint (see clearanceMap())
+ * @param goal Goal region
+ * @param T Output, cost of each cell (cm), -1 if unreachable
+ */
+inline void costToGoal(const Workspace& ws, const Grid<double>& clearance,
+		       const Box& goal, Grid<double>& T)
+{
+	typedef std::pair<double, int> Entry; // Cost, cell
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > heap;
+	const double inf = std::numeric_limits<double>::infinity();
+	const double hx = ws.width/ws.cols, hy = ws.height/ws.rows;
+	std::vector<char> done(ws.cols*ws.rows, 0);
+
+	T.resize(ws.cols, ws.rows);
+	for(int c=0;c<T.size();c++) T.data[c] = inf;
+
+	/* Seeds: free cells in the goal region */
+	for(int j=0;j<ws.rows;j++)
+		for(int i=0;i<ws.cols;i++)
+			if(clearance(i,j)>=0 &&
+			   fabs(ws.x(i)-goal.x)<=goal.width/2 &&
+			   fabs(ws.y(j)-goal.y)<=goal.height/2)
+			{
+				T(i,j) = 0;
+				heap.push(Entry(0, T.index(i,j)));
+			}
+	if(heap.empty() && clearance(ws.col(goal.x), ws.row(goal.y))>=0)
+	{
+		T(ws.col(goal.x), ws.row(goal.y)) = 0;
+		heap.push(Entry(0, T.index(ws.col(goal.x), ws.row(goal.y))));
+	}
+
+	while(!heap.empty())
+	{
+		Entry e = heap.top();
+		heap.pop();
+		if(done[e.second] || e.first>T.data[e.second]) continue;
+		done[e.second] = 1;
+
+		const int ci = e.second%ws.cols, cj = e.second/ws.cols;
+		const int di[] = {1, -1, 0, 0}, dj[] = {0, 0, 1, -1};
+		for(int n=0;n<4;n++)
+		{
+			int i = ci+di[n], j = cj+dj[n];
+			if(i<0 || j<0 || i>=ws.cols || j>=ws.rows) continue;
+			if(done[T.index(i,j)] || clearance(i,j)<0) continue;
+
+			/* Cheapest settled neighbor along each axis */
+			double a = fmin(settledCost(T, done, i-1, j),
+					settledCost(T, done, i+1, j));
+			double b = fmin(settledCost(T, done, i, j-1),
+					settledCost(T, done, i, j+1));
+			double t = fmin(a+hx, b+hy);
+			if(a<inf && b<inf)
+			{
+				/* (t-a)^2/hx^2+(t-b)^2/hy^2 = 1, larger root */
+				double p = 1/(hx*hx), q = 1/(hy*hy);
+				double A = p+q, B = a*p+b*q;
+				double C = a*a*p+b*b*q-1;
+				double disc = B*B-A*C;
+				if(disc>=0)
+				{
+					double r = (B+sqrt(disc))/A;
+					if(r>=fmax(a, b)) t = r;
+				}
+			}
+			if(t<T(i,j))
+			{
+				T(i,j) = t;
+				heap.push(Entry(t, T.index(i,j)));
+			}
+		}
+	}
+
+	for(int c=0;c<T.size();c++) if(!done[c]) T.data[c] = -1;
+}
+
+/**
+ * Gradient of the cost-to-goal field at a position, from the bilinear
+ * interpolation of the costs at the four nearest cell centers. Unreachable
+ * corners are taken as costlier than the others, so that the gradient
+ * points away from obstacles.
+ *
+ * @param ws Workspace geometry
+ * @param T Cost of each cell (see costToGoal())
+ * @param x Position x
+ * @param y Position y
+ * @param gx Output, gradient along x
+ * @param gy Output, gradient along y
+ * @return Whether the position is reachable (some corner is)
+ */
+inline bool fieldGradient(const Workspace& ws, const Grid<double>& T,
+			  double x, double y, double& gx, double& gy)
+{
+	const double hx = ws.width/ws.cols, hy = ws.height/ws.rows;
+	if(ws.cols<2 || ws.rows<2) return false;
+
+	/* Cell centers around the position, and its offset from the first */
+	double u = (x+ws.width/2)/hx-0.5, v = (y+ws.height/2)/hy-0.5;
+	int i = floor(u), j = floor(v);
+	i = i<0 ? 0 : i>ws.cols-2 ? ws.cols-2 : i;
+	j = j<0 ? 0 : j>ws.rows-2 ? ws.rows-2 : j;
+	double fx = fmin(1, fmax(0, u-i)), fy = fmin(1, fmax(0, v-j));
+
+	double c[4] = {T(i,j), T(i+1,j), T(i,j+1), T(i+1,j+1)};
+	double top = -1;
+	for(int k=0;k<4;k++) top = fmax(top, c[k]);
+	if(top<0) return false;
+	for(int k=0;k<4;k++) if(c[k]<0) c[k] = top+hypot(hx, hy);
+
+	gx = ((1-fy)*(c[1]-c[0])+fy*(c[3]-c[2]))/hx;
+	gy = ((1-fx)*(c[2]-c[0])+fx*(c[3]-c[1]))/hy;
+	return true;
+}
+
+/**
+ * Extra cost per unit length of each cell, for the planner to weigh path
+ * lengths with (the CostMap of the RRT* request): paths then keep their
+ * distance from the obstacles and stay in the pertinent area when it costs
+ * little to, instead of grazing the obstacles along the shortest path.
+ *
+ * @param clearance Clearance map of the robot footprint (see clearanceMap())
+ * @param L Pertinence landscape (one layer, in [0,1]), or NULL
+ * @param wc Extra cost at contact with an obstacle, falling linearly to 0
+ * @param range Clearance (cm) from which the obstacles cost nothing
+ * @param wp Extra cost of a cell of null pertinence, falling linearly to 0
+ * @param C Output, extra cost of each cell
+ */
+inline void traversalCost(const Grid<double>& clearance, const Grid<double>* L,
+			  double wc, double range, double wp, Grid<double>& C)
+{
+	C.resize(clearance.cols, clearance.rows);
+	for(int c=0;c<C.size();c++)
+	{
+		double d = fmax(0, clearance.data[c]);
+		C.data[c] = range>0 && d<range ? wc*(1-d/range) : 0;
+		if(L) C.data[c] += wp*(1-fmin(1, fmax(0, L->data[c])));
+	}
+}
+
+} // namespace miro_teleop
+
+#endif
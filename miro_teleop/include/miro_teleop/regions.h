@@ -0,0 +1,138 @@
+#ifndef MIRO_TELEOP_REGIONS_H
+#define MIRO_TELEOP_REGIONS_H
+
+/* Libraries */
+#include "miro_teleop/grid.h"
+#include <vector>
+
+namespace miro_teleop {
+
+/**
+ * Connected region of cells: bounding cells, size and summed score.
+ */
+struct Component
+{
+	int i0, j0, i1, j1; // Bounding cells (included)
+	int cells; // Number of cells
+	double score; // Sum of the scores of its cells
+};
+
+/* Root of a cell in the union-find forest (with path halving) */
+inline int findRoot(std::vector<int>& parent, int c)
+{
+	while(parent[c]!=c)
+	{
+		parent[c] = parent[parent[c]];
+		c = parent[c];
+	}
+	return c;
+}
+
+/* Merges the sets of two cells, the lowest root staying root */
+inline void unite(std::vector<int>& parent, int a, int b)
+{
+	a = findRoot(parent, a);
+	b = findRoot(parent, b);
+	if(a<b) parent[b] = a;
+	else if(b<a) parent[a] = b;
+}
+
+/**
+ * Extracts the connected components of the cells scoring at least a
+ * threshold (4-connected).
+ *
+ * One raster pass joins each cell with its left and lower neighbors in a
+ * union-find forest; the components are then summed up at their roots.
+ *
+ * @param S Scores (one layer)
+ * @param threshold Minimum score
+ * @param labels Output, component of each cell, -1 if below the threshold
+ * @param components Output, the components (indexed by label)
+ */
+inline void connectedComponents(const Grid<double>& S, double threshold,
+				Grid<int>& labels,
+				std::vector<Component>& components)
+{
+	const int cells = S.cols*S.rows;
+	std::vector<int> parent(cells, -1);
+
+	for(int j=0;j<S.rows;j++)
+		for(int i=0;i<S.cols;i++)
+		{
+			const int c = i+S.cols*j;
+			if(S.data[c]<threshold) continue;
+			parent[c] = c;
+			if(i>0 && parent[c-1]>=0) unite(parent, c, c-1);
+			if(j>0 && parent[c-S.cols]>=0)
+				unite(parent, c, c-S.cols);
+		}
+
+	/* Label the roots in raster order, then sum up at them */
+	labels.resize(S.cols, S.rows);
+	components.clear();
+	for(int c=0;c<cells;c++)
+	{
+		if(parent[c]<0) { labels.data[c] = -1; continue; }
+		const int root = findRoot(parent, c);
+		const int i = c%S.cols, j = c/S.cols;
+		if(root==c)
+		{
+			Component comp = {i, j, i, j, 0, 0};
+			labels.data[c] = components.size();
+			components.push_back(comp);
+		}
+		else labels.data[c] = labels.data[root];
+		Component& comp = components[labels.data[c]];
+		comp.i0 = i<comp.i0 ? i : comp.i0;
+		comp.j0 = j<comp.j0 ? j : comp.j0;
+		comp.i1 = i>comp.i1 ? i : comp.i1;
+		comp.j1 = j>comp.j1 ? j : comp.j1;
+		comp.cells++;
+		comp.score += S.data[c];
+	}
+}
+
+/* Whether all the cells of a box (bounds included) have a label */
+inline bool allLabeled(const Grid<int>& labels, int label,
+		       int i0, int j0, int i1, int j1)
+{
+	if(i0<0 || j0<0 || i1>=labels.cols || j1>=labels.rows) return false;
+	for(int j=j0;j<=j1;j++)
+		for(int i=i0;i<=i1;i++)
+			if(labels(i,j)!=label) return false;
+	return true;
+}
+
+/**
+ * Box of cells of one component grown around one of its cells: a column or
+ * a row is added on each side in turn, as long as all its cells are in the
+ * component. Unlike the bounding box of the component, the box holds no
+ * cell of another component or below the threshold, whatever the shape of
+ * the component.
+ *
+ * @param labels Component of each cell (see connectedComponents())
+ * @param i, j Starting cell
+ * @param i0, j0, i1, j1 Output, bounding cells of the box (included);
+ * the starting cell alone if it is in no component
+ */
+inline void componentBox(const Grid<int>& labels, int i, int j,
+			 int& i0, int& j0, int& i1, int& j1)
+{
+	const int label = labels(i,j);
+	bool grown = label>=0;
+
+	i0 = i1 = i;
+	j0 = j1 = j;
+	while(grown)
+	{
+		grown = false;
+		if(allLabeled(labels, label, i0-1, j0, i0-1, j1)) { i0--; grown = true; }
+		if(allLabeled(labels, label, i1+1, j0, i1+1, j1)) { i1++; grown = true; }
+		if(allLabeled(labels, label, i0, j0-1, i1, j0-1)) { j0--; grown = true; }
+		if(allLabeled(labels, label, i0, j1+1, i1, j1+1)) { j1++; grown = true; }
+	}
+}
+
+} // namespace miro_teleop
+
+#endif
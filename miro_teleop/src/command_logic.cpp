@@ -1,5 +1,10 @@
 /* Libraries */
 #include "ros/ros.h"
+#include "miro_teleop/components.h"
+#include "miro_teleop/grid.h"
+#include "miro_teleop/navigation.h"
+#include "ros/callback_queue.h"
+#include "ros/topic.h"
 #include "std_msgs/Bool.h"
 #include "std_msgs/Float64.h"
 #include "std_msgs/UInt8.h"
@@ -17,28 +22,263 @@
 #include <iostream>
 #include <cmath>
 #include "miro_teleop/Path.h"
+#include "miro_teleop/Field.h"
+#include "miro_teleop/Command.h"
+#include "miro_teleop/CommandAck.h"
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <queue>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace command_logic {
 
 /* Definitions */
-#define RES 40 // Grid resolution
-#define NZ 5 // Number of relations (north, south, west, east, distance-to)
-#define HSIZE 400
-#define VSIZE 400
+#define NBINS 14 // Latency histogram bins (below 1, 2, 4, ... ms, then above)
+#define RECONNECT_TIMEOUT 5.0 // Time to wait for a lost service to return (s)
+
+/* Command waiting to be served, in order of priority then arrival */
+struct Pending
+{
+	miro_teleop::Command cmd;
+	unsigned long order; // Arrival number
+	bool operator<(const Pending& other) const
+	{
+		if (cmd.priority != other.cmd.priority)
+			return cmd.priority < other.cmd.priority;
+		return order > other.order;
+	}
+};
+
+/**
+ * Persistent service client.
+ *
+ * Keeps one connection to the server for all calls instead of opening one
+ * per call. If a call fails (e.g. the server was restarted and the
+ * connection is lost), the client reconnects, waiting up to
+ * RECONNECT_TIMEOUT for the service, and retries once.
+ *
+ * The latency of every call is recorded in a histogram of power-of-two
+ * millisecond bins, along with the number of calls, failures and
+ * reconnections.
+ */
+struct Service
+{
+	std::string name;
+	ros::ServiceClient client;
+	std::function<ros::ServiceClient()> open; // Opens a new connection
+	bool up; // Last known health
+	unsigned int calls, failures, reconnections, reported;
+	unsigned int histogram[NBINS]; // Bin b: latency below 2^b ms
+	double total, max; // Latency sum and maximum (ms)
+
+	/**
+	 * Opens the persistent connection to a service of type S.
+	 */
+	template <class S>
+	void connect(const std::string& service)
+	{
+		name = service;
+		open = [service]()
+		{ return ros::NodeHandle().serviceClient<S>(service, true); };
+		client = open();
+		up = true;
+		calls = failures = reconnections = reported = 0;
+		for(int b=0;b<NBINS;b++) histogram[b] = 0;
+		total = max = 0;
+	}
+
+	/**
+	 * Calls the service, reconnecting (and retrying once) if needed.
+	 */
+	template <class S>
+	bool call(S& srv)
+	{
+		ros::WallTime start = ros::WallTime::now();
+		bool ok = client.isValid() && client.call(srv);
+		if(!ok)
+		{
+			ROS_INFO("Reconnecting to %s", name.c_str());
+			client = open();
+			reconnections++;
+			ok = client.waitForExistence(ros::Duration(RECONNECT_TIMEOUT))
+			     && client.call(srv);
+		}
+		double ms = (ros::WallTime::now()-start).toSec()*1000;
+
+		calls++;
+		if(!ok) failures++;
+		int b = 0;
+		while(b<NBINS-1 && ms>=(1<<b)) b++;
+		histogram[b]++;
+		total += ms;
+		if(ms>max) max = ms;
+		return ok;
+	}
+
+	/**
+	 * Checks that the service is advertised, and reopens the connection
+	 * when it comes back after being lost.
+	 */
+	void check()
+	{
+		bool now = client.exists();
+		if(now && !client.isValid())
+		{
+			client = open();
+			reconnections++;
+		}
+		if(now!=up)
+		{
+			if(now) ROS_INFO("Service %s is back", name.c_str());
+			else ROS_ERROR("Service %s is down", name.c_str());
+		}
+		up = now;
+	}
+
+	/**
+	 * Logs the call statistics and the non-empty histogram bins.
+	 */
+	void report()
+	{
+		char line[512];
+		int len = snprintf(line, sizeof(line),
+			"%s: %u calls, %u failed, %u reconnections, "
+			"mean %.1f ms, max %.1f ms |", name.c_str(), calls, failures,
+			reconnections, calls ? total/calls : 0, max);
+		for(int b=0;b<NBINS && len<sizeof(line);b++)
+		{
+			if(histogram[b]==0) continue;
+			if(b<NBINS-1)
+			len += snprintf(line+len, sizeof(line)-len, " <%dms:%u",
+				1<<b, histogram[b]);
+			else
+			len += snprintf(line+len, sizeof(line)-len, " >=%dms:%u",
+				1<<(b-1), histogram[b]);
+		}
+		ROS_INFO("%s", line);
+		reported = calls;
+	}
+};
 
 /* Global variables */
-std_msgs::UInt8 cmd; // Command tag received from interpreter
+std::vector<Service*> services; // All service clients, for health checks
+std::priority_queue<Pending> commands; // Commands waiting to be served
+std::map<std::string, unsigned int> last_seq; // Last command of each source
+unsigned long arrivals = 0; // Number of commands received
+int running = -1; // Priority of the command being served (-1 if none)
+std::atomic<bool> preempt(false); // Set when a more urgent command arrives
+bool stopped = false; // Set when a stop arrives during the served command
+std::mutex cmd_mutex; // Command callback vs. main loop
+std::condition_variable cmd_cond; // Signals a new command to the main loop
+ros::Publisher ack_pub; // Acknowledgements to the command sources
+ros::Publisher flag_pub; // Enable flag to the robot controller
+bool plotting = true; // Display landscapes with OpenCV (waits for a key)
 geometry_msgs::Pose2D obs, robot; // Obstacle and robot positions from mocap
 geometry_msgs::Pose gesture; // Gesture information from mocap
 
+/**
+ * Publishes the status of a command to its source.
+ */
+void ack(const miro_teleop::Command& cmd, unsigned char status)
+{
+	miro_teleop::CommandAck msg;
+	msg.seq = cmd.seq;
+	msg.source = cmd.source;
+	msg.status = status;
+	ack_pub.publish(msg);
+}
+
 /** 
- * Subscriber callback function.
- * Obtains command tag from Interpreter node. 
+ * Subscriber callback function (command queue).
+ * Obtains commands from the Interpreter (or any other command source).
+ *
+ * Runs on its own spinner thread, so that commands are received while a
+ * look is in progress. Every command is acknowledged on receipt; resent
+ * copies (same or older sequence number) are acknowledged again and
+ * dropped. A command more urgent than the one being served preempts it.
+ *
+ * A stop disables the controller right away and discards the less urgent
+ * commands still waiting, so that nothing queued before it moves the robot.
  */
-void getCmd(const std_msgs::UInt8::ConstPtr& msg)
+void getCmd(const miro_teleop::Command::ConstPtr& msg)
 {
-	cmd.data = msg->data;
-	ROS_INFO("Command received from interpreter");
+	std::lock_guard<std::mutex> lock(cmd_mutex);
+
+	/* Duplicates (a sequence restarting from 1 is a new source run) */
+	std::map<std::string, unsigned int>::iterator last =
+		last_seq.find(msg->source);
+	if (last != last_seq.end() && msg->seq <= last->second &&
+	    !(msg->seq == 1 && last->second > 1))
+	{
+		ack(*msg, miro_teleop::CommandAck::RECEIVED);
+		return;
+	}
+	last_seq[msg->source] = msg->seq;
+	ack(*msg, miro_teleop::CommandAck::RECEIVED);
+	ROS_INFO("Command %u [%d] received from %s", msg->seq, msg->command,
+		msg->source.c_str());
+
+	if (msg->command == msg->STOP)
+	{
+		std_msgs::Bool disable;
+		disable.data = false;
+		flag_pub.publish(disable);
+
+		std::priority_queue<Pending> kept;
+		for (;!commands.empty();commands.pop())
+		{
+			if (commands.top().cmd.priority < msg->priority)
+				ack(commands.top().cmd,
+				    miro_teleop::CommandAck::PREEMPTED);
+			else
+				kept.push(commands.top());
+		}
+		commands.swap(kept);
+		if (running >= 0) stopped = true;
+	}
+
+	if (running >= 0 && msg->priority > running) preempt = true;
+
+	Pending p;
+	p.cmd = *msg;
+	p.order = arrivals++;
+	commands.push(p);
+	cmd_cond.notify_one();
+}
+
+/**
+ * Waits up to a loop period for the most urgent command and takes it.
+ *
+ * @param cmd Output, the command to be served
+ * @return True if a command was taken
+ */
+bool nextCmd(miro_teleop::Command& cmd)
+{
+	std::unique_lock<std::mutex> lock(cmd_mutex);
+	if (commands.empty())
+		cmd_cond.wait_for(lock, std::chrono::milliseconds(100));
+	if (commands.empty()) return false;
+
+	cmd = commands.top().cmd;
+	commands.pop();
+	running = cmd.priority;
+	preempt = false;
+	stopped = false;
+	return true;
+}
+
+/**
+ * Marks the command being served as finished and acknowledges its outcome.
+ */
+void endCmd(const miro_teleop::Command& cmd, unsigned char status)
+{
+	std::lock_guard<std::mutex> lock(cmd_mutex);
+	running = -1;
+	ack(cmd, status);
 }
 
 /** 
@@ -77,32 +317,130 @@ void getObstaclePose(const geometry_msgs::Pose2D::ConstPtr& groundpose)
 
 /** 
  * OpenCV Plot function.
- * Attaches matrix information to an img variable and displays it on screen. 
+ * Attaches one layer of a landscape grid to an img variable (scaled to
+ * [0,255], one pixel per cell, row 0 on top) and displays it on screen. 
  */
-void plot(const char* name, float matrix[][RES])
+void plot(const char* name, miro_teleop::Grid<double>& grid, int layer = 0)
 {
+	if(!plotting) return;
 	cv::Mat img;
-	cv::Mat map(RES, RES, CV_32F, matrix);
-	map.convertTo(img, CV_8UC1);
+	cv::Mat map(grid.rows, grid.cols, CV_64F, grid.layer(layer));
+	map.convertTo(img, CV_8UC1, 255);
 	cv::namedWindow(name, cv::WINDOW_NORMAL);
 	cv::imshow(name, img);
 	cv::waitKey(0);
 }
 
 /**
- * Command Logic Node main function.
+ * Readiness barrier.
+ * Waits until all services are advertised, within a common timeout.
+ *
+ * The servers advertise their service only after prewarming (landscapes,
+ * random generator, planner), so an advertised service is ready to answer.
+ *
+ * @param clients Service clients to wait for
+ * @param timeout Maximum waiting time (s)
+ * @param boot Node start time, for the log
+ * @return True if all services are ready in time
+ */
+bool waitForServices(std::vector<Service*>& clients,
+		     double timeout, ros::WallTime boot)
+{
+	ros::WallTime start = ros::WallTime::now();
+	for(int i=0;i<clients.size();i++)
+	{
+		double left = timeout-(ros::WallTime::now()-start).toSec();
+		if(left<=0 ||
+		   !clients[i]->client.waitForExistence(ros::Duration(left)))
+		{
+			ROS_ERROR("Service %s not ready after %.1f s",
+			clients[i]->name.c_str(), timeout);
+			return false;
+		}
+		ROS_INFO("Service %s ready at %.2f s",
+		clients[i]->name.c_str(), (ros::WallTime::now()-boot).toSec());
+	}
+	return true;
+}
+
+/**
+ * Timer callback function.
+ * Checks the health of all services, and logs the latency statistics of
+ * those called since the last report.
+ */
+void checkServices(const ros::WallTimerEvent&)
+{
+	for(int i=0;i<services.size();i++)
+	{
+		services[i]->check();
+		if(services[i]->calls!=services[i]->reported)
+		services[i]->report();
+	}
+}
+
+/**
+ * Command Logic Node loop.
  * Calls services and set robot motion according to commands received.
  * 
- * In its initialization, the node calls the Spatial Reasoner service once to 
- * obtain all landscapes from the current workspace setting. Then, the execution
- * flow will depend on the command received from the Interpreter:
+ * In its initialization, the node waits until all services are ready and the
+ * obstacle pose is known (within ~ready_timeout seconds), then calls the
+ * Spatial Reasoner service once to obtain all landscapes from the current
+ * workspace setting. The time from start to ready, and to the end of the
+ * first look, is logged. Setting ~plot to false skips the landscape plots,
+ * which wait for a key press. Then, the execution
+ * flow will depend on the command received from the Interpreter.
+ *
+ * Commands are received on their own thread and queued by priority (stop,
+ * then go, then look), each acknowledged to its source on receipt and again
+ * when done, failed or preempted. A stop disables the controller as soon
+ * as it is received and drops the less urgent commands still queued; a
+ * more urgent command arriving during a look preempts it, the look being
+ * abandoned before its next service call and its path not published. The
+ * outcome of a command is decided, and the controller enabled, under the
+ * command lock: a stop received while a command is served is never
+ * followed by an enable from that command.
+ *
+ * Service clients keep a persistent connection, reconnecting if a server is
+ * restarted; a service that still fails makes the look fail instead of
+ * ending the node. Every ~health_interval seconds the services are checked
+ * and the latency histograms of those called meanwhile are logged.
+ *
+ * The workspace geometry (workspace/width, workspace/height and the grid
+ * resolution) and the obstacle dimensions (obstacle/width, obstacle/height)
+ * are loaded at startup, shared with the servers; the goal region given to
+ * the planner is ~goal_width x ~goal_height.
  *
  * If cmd = 1 (look), the following services are called in this order:
  * Gesture Processing - returns the target position
  * Pertinence Mapping - returns the mapped fuzzy landscape
  * Monte Carlo Simulation - computes the goal position
  * RRT* Path Planner - Generates optimal trajectory from robot position to goal
+ * (if the goal cannot be reached, the alternate goals returned by the Monte
+ * Carlo Simulation are tried in turn). The goal region is the pertinent
+ * region around the goal returned along with it, unless ~goal_regions is
+ * false or the region is smaller than ~goal_width x ~goal_height.
+ *
+ * Paths are the shortest ones unless ~clearance_cost or ~pertinence_cost is
+ * positive: the planner then weighs their length by a cost map, up to
+ * 1+~clearance_cost times near the obstacles (falling to 1 at
+ * ~clearance_range cm) and 1+~pertinence_cost times out of the pertinent
+ * area, so that they keep safe distances.
+ *
+ * If ~navigation is true (static scenes), no path is planned: a cost-to-goal
+ * field over the grid is computed once per goal instead and published for
+ * the Robot Controller to descend, without stopping at waypoints.
  * The trajectory obtained is published to the Robot Controller. 
+ * If the look came as a spatial query (e.g. "look north of the box"), the
+ * gesture step is skipped and the query relation weights are sent to the
+ * Pertinence Mapping service instead of the pointed target. If the query was
+ * a go (e.g. "go north of the box"), the robot is enabled once the path is
+ * published.
+ *
+ * Pointing gestures are noisy: if ~gesture_spread (cm) is positive, the
+ * target and four samples around it, ~gesture_spread away along x and y,
+ * are mapped in one Pertinence Mapping call and the maximum of their
+ * landscapes is used, so that a slightly wrong target still covers the
+ * intended side.
  *
  * If cmd = 2 (go), the flag enable is set to 'true' and also sent to the 
  * Controller. In this moment, MIRO should move.
@@ -111,14 +449,30 @@ void plot(const char* name, float matrix[][RES])
  * The robot should stop.
  * 
  * If any other command tag is received, it is ignored.
+ *
+ * The callbacks of the node (poses and health checks) are served on a queue
+ * of its own, so that the loop can share a process with other nodes.
  */
-int main(int argc, char **argv)
+int run(ros::NodeHandle& n, ros::NodeHandle& pn)
 {
 	/* Definitions */
 	geometry_msgs::Pose2D target, goal; // Target and goal positions
+	std::vector<geometry_msgs::Pose2D> candidates; // Goals, from the best
+	std::vector<rrtstar_msgs::Region> regions; // Goal region of each
+	bool use_regions; // Whether goal regions are given to the planner
+	bool navigation; // Cost-to-goal field instead of an RRT* path
+	miro_teleop::Field field; // Field to be published (navigation)
+	miro_teleop::Grid<double> occupancy, cost; // For the field
+	double path_cost[3]; // Clearance cost, its range (cm), pertinence cost
 	miro_teleop::Path rrtPath; // Trajectory to be published
-	std_msgs::Float64 matrices[NZ*RES*RES]; // From spatial reasoner
-	std_msgs::Float64 landscape[RES*RES]; // From pertinence mapping
+	miro_teleop::Workspace ws; // Workspace discretization
+	double goal_size[2]; // Goal region dimensions
+	double spread; // Distance of the gesture target samples (cm)
+	std::vector<std_msgs::Float64> matrices; // From spatial reasoner
+	std::vector<std_msgs::Float64> premultiplied, maxima; // Likewise
+	std::vector<std_msgs::Float64> landscape; // From pertinence mapping
+	miro_teleop::Grid<double> plotted; // Landscapes being plotted
+	miro_teleop::Grid<double> mapped; // Mapped landscape (pertinence)
 	std_msgs::Bool enable; // Controller enable flag
 	miro_msgs::platform_control cmd_turn; // Turn command for "look"
 	rrtstar_msgs::Region workspace, goal_reg, obs_reg; // For RRT* algorithm
@@ -126,32 +480,60 @@ int main(int argc, char **argv)
 	double dtheta; // For turning command
 	double pathsize; // Since RRT* trajectory size is variable
 	int state = 0; // Control flag for the "look" command
+	double timeout; // Readiness barrier timeout (s)
+	double health; // Service health check period (s)
+	bool first_look = true; // For the cold start measurement
+	ros::WallTime look_start; // Start time of the look being served
+	miro_teleop::Command cmd; // Command being served
+	ros::CallbackQueue queue; // Served by the main loop
+	ros::CallbackQueue cmd_queue; // Served apart from the main loop
+	ros::WallTime boot = ros::WallTime::now(); // Node start time
 
 	enable.data = false;
 
-	/* Obstacle dimensions (predefined) */
-	std_msgs::Float64 obsdim[2];
-	obsdim[0].data = 80;
-	obsdim[1].data = 80;
+	std_msgs::Float64 obsdim[2]; // Obstacle dimensions
 
-	/* Initialize and assign node handler */
-	ros::init(argc, argv, "command_logic");
-	ros::NodeHandle n;
+	n.setCallbackQueue(&queue);
+	pn.param("ready_timeout", timeout, 30.0);
+	pn.param("plot", plotting, true);
+	pn.param("health_interval", health, 5.0);
+	pn.param("goal_width", goal_size[0], 20.0);
+	pn.param("goal_height", goal_size[1], 20.0);
+	pn.param("gesture_spread", spread, 0.0);
+	pn.param("goal_regions", use_regions, true);
+	pn.param("navigation", navigation, false);
+	pn.param("clearance_cost", path_cost[0], 0.0);
+	pn.param("clearance_range", path_cost[1], 40.0);
+	pn.param("pertinence_cost", path_cost[2], 0.0);
+	n.param("obstacle/width", obsdim[0].data, 80.0);
+	n.param("obstacle/height", obsdim[1].data, 80.0);
+	ws = miro_teleop::Workspace::load(n);
 
 	/* Initialize publishers and subscribers */
 	// Publishers to robot controller
 	ros::Publisher path_pub =
 	n.advertise<miro_teleop::Path>("path", 1);
-	ros::Publisher flag_pub =
+	ros::Publisher field_pub =
+	n.advertise<miro_teleop::Field>("field", 1);
+	flag_pub =
 	n.advertise<std_msgs::Bool>("enable", 1);
 	// Publisher to miro
 	ros::Publisher miro_pub = 
 	n.advertise<miro_msgs::platform_control>
 	("/miro/rob01/platform/control", 10);
 
-	// Subscriber from command interpreter
-	ros::Subscriber sub_cmd =
-	n.subscribe("command", 3, getCmd);
+	// Acknowledgements to command interpreter
+	ack_pub =
+	n.advertise<miro_teleop::CommandAck>("command_ack", 10);
+
+	// Subscriber from command interpreter, on its own spinner so that
+	// commands arrive (and preempt) while a look is in progress
+	ros::SubscribeOptions cmd_ops =
+	ros::SubscribeOptions::create<miro_teleop::Command>
+	("command", 10, getCmd, ros::VoidPtr(), &cmd_queue);
+	ros::Subscriber sub_cmd = n.subscribe(cmd_ops);
+	ros::AsyncSpinner cmd_spinner(1, &cmd_queue);
+	cmd_spinner.start();
 	// Subscribers from motion capture (mocap)
 	ros::Subscriber sub_robot =
 	n.subscribe("Robot/ground_pose", 10, getRobotPose);
@@ -160,36 +542,58 @@ int main(int argc, char **argv)
 	ros::Subscriber sub_obs =
 	n.subscribe("Obstacle/ground_pose", 1, getObstaclePose);
 
-	/* Initialize service clients and handlers */
-	ros::ServiceClient cli_spat =
-	n.serviceClient<miro_teleop::SpatialReasoner>("spatial_reasoner");
+	/* Initialize (persistent) service clients and handlers */
+	Service cli_spat;
+	cli_spat.connect<miro_teleop::SpatialReasoner>("spatial_reasoner");
 	miro_teleop::SpatialReasoner srv_spat;
 
-	ros::ServiceClient cli_gest =
-	n.serviceClient<miro_teleop::GestureProcessing>("gesture_processing");
+	Service cli_gest;
+	cli_gest.connect<miro_teleop::GestureProcessing>("gesture_processing");
 	miro_teleop::GestureProcessing srv_gest;
 
-	ros::ServiceClient cli_pert =
-	n.serviceClient<miro_teleop::PertinenceMapping>("pertinence_mapper");
+	Service cli_pert;
+	cli_pert.connect<miro_teleop::PertinenceMapping>("pertinence_mapper");
 	miro_teleop::PertinenceMapping srv_pert;
 
-	ros::ServiceClient cli_mont =
-	n.serviceClient<miro_teleop::MonteCarlo>("monte_carlo");
+	Service cli_mont;
+	cli_mont.connect<miro_teleop::MonteCarlo>("monte_carlo");
 	miro_teleop::MonteCarlo srv_mont;
 
-	ros::ServiceClient cli_rrts =
-	n.serviceClient<rrtstar_msgs::rrtStarSRV>("rrtStarService");
+	Service cli_rrts;
+	cli_rrts.connect<rrtstar_msgs::rrtStarSRV>("rrtStarService");
 	rrtstar_msgs::rrtStarSRV srv_rrts;
 
-	/* Update rate (period) */
-	ros::Rate loop_rate(10);
+	services.push_back(&cli_spat);
+	services.push_back(&cli_gest);
+	services.push_back(&cli_pert);
+	services.push_back(&cli_mont);
+	services.push_back(&cli_rrts);
+
+	/* Readiness barrier: all services, then the obstacle pose */
+	if(!waitForServices(services, timeout, boot)) return 1;
+
+	/* Periodic health checks and latency reports */
+	ros::WallTimer health_timer =
+	n.createWallTimer(ros::WallDuration(health), checkServices);
 
-	/* Characterize workspace region (predefined) */
+	geometry_msgs::Pose2D::ConstPtr obs_pose =
+	ros::topic::waitForMessage<geometry_msgs::Pose2D>
+	("Obstacle/ground_pose", n, ros::Duration(timeout));
+	if(obs_pose)
+	{
+		obs.x = 100*obs_pose->x;
+		obs.y = 100*obs_pose->y;
+		obs.theta = obs_pose->theta;
+	}
+	else
+	ROS_ERROR("No obstacle pose received: assuming (0,0)");
+
+	/* Characterize workspace region */
 	workspace.center_x = 0;
 	workspace.center_y = 0;
 	workspace.center_z = 0;
-	workspace.size_x = HSIZE;
-	workspace.size_y = VSIZE;
+	workspace.size_x = ws.width;
+	workspace.size_y = ws.height;
 	workspace.size_z = 0;
 
 	srv_rrts.request.WS = workspace; // RRT* request member
@@ -207,6 +611,8 @@ int main(int argc, char **argv)
 	/* Initialization */
 
 	ROS_INFO("Command logic (master) node active");
+	ROS_INFO("Workspace %gx%g cm, %dx%d cells", ws.width, ws.height,
+		 ws.cols, ws.rows);
 	ROS_INFO("Initialization: calling spatial reasoner");
 
 	// Set the matrices, by calling spatial reasoner
@@ -216,35 +622,23 @@ int main(int argc, char **argv)
 
 	if (cli_spat.call(srv_spat))
 	{
-		// Matrices to be plotted by opencv
-		float   spmat0[RES][RES], spmat1[RES][RES],
-			spmat2[RES][RES], spmat3[RES][RES],
-			spmat4[RES][RES];
-
-		for (int i=0;i<NZ*RES*RES;i++){
-			matrices[i].data = srv_spat.response.matrices[i].data;
-			int depth=i/(RES*RES);
-			int l_ind = i%(RES*RES);
-			if(depth==0)
-			spmat0[l_ind/RES][l_ind%RES]=matrices[i].data*255;
-			if(depth==1)
-			spmat1[l_ind/RES][l_ind%RES]=matrices[i].data*255;
-			if(depth==2)
-			spmat2[l_ind/RES][l_ind%RES]=matrices[i].data*255;
-			if(depth==3)
-			spmat3[l_ind/RES][l_ind%RES]=matrices[i].data*255;
-			if(depth==4)
-			spmat4[l_ind/RES][l_ind%RES]=matrices[i].data*255;
-		}
+		matrices = srv_spat.response.matrices;
+		premultiplied = srv_spat.response.premultiplied;
+		maxima = srv_spat.response.maxima;
 		
 		// Display landscapes (requires opencv package)
-		plot("North", spmat0);
-		plot("West" , spmat1);
-		plot("South", spmat2);
-		plot("East",  spmat3);
-		plot("Distance", spmat4);
+		miro_teleop::fromMsg(matrices, ws.cols, ws.rows, plotted);
+		if(plotted.layers==NZ)
+		{
+		plot("North", plotted, 0);
+		plot("West" , plotted, 1);
+		plot("South", plotted, 2);
+		plot("East",  plotted, 3);
+		plot("Distance", plotted, 4);
+		}
 
 		ROS_INFO("Environment landscapes generated succesfully");
+		ROS_INFO("Ready after %.2f s", (ros::WallTime::now()-boot).toSec());
 	}
 	else
 	{
@@ -255,11 +649,28 @@ int main(int argc, char **argv)
 	/* Main loop */
 	while(ros::ok())
 	{
-		/* Command: look */
-		if(cmd.data==1)
+		/* Update poses from mocap */
+		queue.callAvailable();
+
+		/* Wait (up to a period) for the most urgent command */
+		if(!nextCmd(cmd)) continue;
+
+		/* Command: look (or go with spatial relations) */
+		if(cmd.command==cmd.LOOK ||
+		  (cmd.command==cmd.GO && !cmd.weights.empty()))
 		{
 			state = 0;
+			look_start = ros::WallTime::now();
 
+			// Spatial query: relations given, no gesture needed
+			if(!cmd.weights.empty())
+			{
+				ROS_INFO("Using relation weights from query");
+				target = obs;
+				state = 1;
+			}
+			else
+			{
 			// First, call gesture processing service
 			ROS_INFO("Calling Gesture Processing service");
 			ROS_INFO("Gesture x: %f", gesture.position.x);
@@ -279,8 +690,7 @@ int main(int argc, char **argv)
 				else
 				ROS_INFO("Invalid target: please try again");
 				// Verify bound conditions
-				if(target.x < -HSIZE/2 || target.x > HSIZE/2 ||
-				   target.y < -VSIZE/2 || target.y > VSIZE/2)
+				if(!ws.contains(target.x, target.y))
 				{
 					ROS_INFO("Target out of the bounds");
 					state = 0;
@@ -289,31 +699,43 @@ int main(int argc, char **argv)
 			else
 			{
 				ROS_ERROR("Failed to call Gesture Processing");
-				return 1;
+				state = 0;
+			}
 			}
 
 			// Then, call pertinence mapping service
-			if(state==1)
+			if(state==1 && !preempt)
 			{
 			ROS_INFO("Calling Pertinence Mapping service");
 			srv_pert.request.target = target;
-			for (int i=0;i<RES*RES*NZ;i++)
-			srv_pert.request.matrices.push_back(matrices[i]);
-
-			if (cli_pert.call(srv_pert))
+			srv_pert.request.weights = cmd.weights;
+			srv_pert.request.targets.clear();
+			if(cmd.weights.empty() && spread>0)
 			{
-				float pertmatrix[RES][RES];
-				for (int i=0;i<RES*RES;i++) 
+				// Target and samples around it, merged
+				const double dx[] = {0, spread, -spread, 0, 0};
+				const double dy[] = {0, 0, 0, spread, -spread};
+				for(int k=0;k<5;k++)
 				{
-					landscape[i].data = 
-					srv_pert.response.landscape[i].data;
-					//For OpenCV plot
-					pertmatrix[i/RES][i%RES] =
-					srv_pert.response.landscape[i].data*255;
+					geometry_msgs::Pose2D sample = target;
+					sample.x += dx[k];
+					sample.y += dy[k];
+					if(ws.contains(sample.x, sample.y))
+					srv_pert.request.targets.push_back(sample);
 				}
+				srv_pert.request.combine = true;
+			}
+			srv_pert.request.matrices = matrices;
+			srv_pert.request.premultiplied = premultiplied;
+			srv_pert.request.maxima = maxima;
+
+			if (cli_pert.call(srv_pert))
+			{
+				landscape = srv_pert.response.landscape;
 
 				// Verify whether the output is valid
-				if(!std::isfinite(landscape[0].data))
+				if(landscape.size()!=ws.cols*ws.rows ||
+				   !std::isfinite(landscape[0].data))
 				{
 					state = 0;
 					ROS_INFO("Invalid pertinence mapping");
@@ -323,31 +745,36 @@ int main(int argc, char **argv)
 					state = 2;
 					ROS_INFO("Landscapes mapped");
 					// Plot using opencv
-					plot("Mapped landscape", pertmatrix);	
+					miro_teleop::fromMsg(landscape,
+						ws.cols, ws.rows, mapped);
+					plot("Mapped landscape", mapped);	
 				}
 			}
 			else
 			{
 				ROS_ERROR("Failed to call Pertinence Mapping");
-				return 1;
+				state = 0;
 			}
 			srv_pert.request.matrices.clear();
 			}
 
 			// After, call monte carlo service
-			if(state==2)
+			if(state==2 && !preempt)
 			{
 			ROS_INFO("Calling Monte Carlo Simulation service");
 			srv_mont.request.P = target;
-			for (int i=0;i<RES*RES;i++)
-			srv_mont.request.landscape.push_back(landscape[i]);
+			srv_mont.request.landscape = landscape;
+			srv_mont.request.obstacles =
+				srv_rrts.request.Obstacles;
+			srv_mont.request.footprint.resize(2);
+			srv_mont.request.footprint[0].data = goal_size[0];
+			srv_mont.request.footprint[1].data = goal_size[1];
 
 			if (cli_mont.call(srv_mont))
 			{
 				goal = srv_mont.response.goal;
 				// Verify if goal returned is valid
-				if(goal.x<-HSIZE/2 || goal.x>HSIZE/2
-				|| goal.y<-VSIZE/2 || goal.y>VSIZE/2)
+				if(!ws.contains(goal.x, goal.y))
 				{
 					ROS_INFO("Invalid goal position");
 					state = 0;
@@ -357,42 +784,146 @@ int main(int argc, char **argv)
 					ROS_INFO("Goal obtained: (%f,%f)",
 					goal.x, goal.y);
 					state = 3;
+					// Alternates, valid ones only (the
+					// goal alone from an older server)
+					const std::vector<geometry_msgs::Pose2D>&
+					alt = srv_mont.response.candidates;
+					const std::vector<rrtstar_msgs::Region>&
+					reg = srv_mont.response.regions;
+					candidates.assign(1, goal);
+					regions.assign(1, rrtstar_msgs::Region());
+					if(!reg.empty()) regions[0] = reg[0];
+					for(int c=1;c<alt.size();c++)
+					if(ws.contains(alt[c].x, alt[c].y))
+					{
+						candidates.push_back(alt[c]);
+						regions.push_back(c<reg.size() ?
+						reg[c] : rrtstar_msgs::Region());
+					}
 				}
 			}
 			else
 			{
 				ROS_ERROR("Failed to call Monte Carlo service");
-				return 1;
+				state = 0;
 			}
 			srv_mont.request.landscape.clear();
 			}
 
-			// Finally, call RRT* server and publish path
-			if(state==3)
+			// Cost map of the planner, if paths are to be weighted
+			// by clearance or pertinence (same for all the goals)
+			srv_rrts.request.CostMap.clear();
+			srv_rrts.request.CostCols = 0;
+			if(state==3 && !navigation &&
+			   (path_cost[0]>0 || path_cost[2]>0))
 			{
-			ROS_INFO("Calling RRT* Path Planner service");
+				std::vector<miro_teleop::Box> boxes;
+				for(int o=0;o<srv_rrts.request.Obstacles.size();o++)
+				{
+					const rrtstar_msgs::Region& r =
+						srv_rrts.request.Obstacles[o];
+					boxes.push_back(miro_teleop::Box(r.center_x,
+						r.center_y, r.size_x, r.size_y));
+				}
+				miro_teleop::clearanceMap(ws, boxes, goal_size[0],
+					goal_size[1], occupancy);
+				miro_teleop::traversalCost(occupancy, &mapped,
+					path_cost[0], path_cost[1], path_cost[2],
+					cost);
+				srv_rrts.request.CostMap = cost.data;
+				srv_rrts.request.CostCols = ws.cols;
+			}
+
+			// Finally, call RRT* server (or compute the navigation
+			// field) and publish path, trying the alternate goals in
+			// turn if a goal cannot be reached
+			for(int c=0;c<candidates.size() && state==3 && !preempt;c++)
+			{
+			goal = candidates[c];
+			if(c>0) ROS_INFO("Trying alternate goal %d: (%f,%f)",
+					 c, goal.x, goal.y);
 
 			// Initial position is robot current one
 			init.x = robot.x;
 			init.y = robot.y;
 			init.z = 0;
 
-			// Define goal region
+			// Define goal region: the pertinent region around the
+			// goal if any, otherwise a fixed one centered on it.
+			// Either way the path ends at the goal itself
+			if(use_regions && regions[c].size_x>=goal_size[0] &&
+			   regions[c].size_y>=goal_size[1])
+			{
+				goal_reg = regions[c];
+				ROS_INFO("Goal region: %.0fx%.0f cm",
+					goal_reg.size_x, goal_reg.size_y);
+			}
+			else
+			{
 			goal_reg.center_x = goal.x; //TEST
 			goal_reg.center_y = goal.y; //TEST
 			goal_reg.center_z = 0;
-			goal_reg.size_x = 20;
-			goal_reg.size_y = 20;
+			goal_reg.size_x = goal_size[0];
+			goal_reg.size_y = goal_size[1];
 			goal_reg.size_z = 0;
+			}
 
 			// Note: workscape and object regions already defined
 			srv_rrts.request.Goal = goal_reg;
+			srv_rrts.request.GoalState.resize(1);
+			srv_rrts.request.GoalState[0].x = goal.x;
+			srv_rrts.request.GoalState[0].y = goal.y;
+			srv_rrts.request.GoalState[0].z = 0;
 			srv_rrts.request.Init = init;
 
+			// Navigation: cost-to-goal field, descended by the
+			// controller (obstacles as given to the planner)
+			if(navigation)
+			{
+				ROS_INFO("Computing the cost-to-goal field");
+				std::vector<miro_teleop::Box> boxes;
+				for(int o=0;o<srv_rrts.request.Obstacles.size();o++)
+				{
+					const rrtstar_msgs::Region& r =
+						srv_rrts.request.Obstacles[o];
+					boxes.push_back(miro_teleop::Box(r.center_x,
+						r.center_y, r.size_x, r.size_y));
+				}
+				miro_teleop::clearanceMap(ws, boxes, goal_size[0],
+					goal_size[1], occupancy);
+				miro_teleop::costToGoal(ws, occupancy,
+					miro_teleop::Box(goal_reg.center_x,
+					goal_reg.center_y, goal_reg.size_x,
+					goal_reg.size_y), cost);
+				if(cost(ws.col(robot.x), ws.row(robot.y))<0)
+				{
+					ROS_INFO("Goal not reachable from the robot");
+				}
+				else
+				{
+					field.width = ws.width;
+					field.height = ws.height;
+					field.cols = ws.cols;
+					field.rows = ws.rows;
+					miro_teleop::toMsg(cost, field.cost);
+					field.goal = goal_reg;
+					state = 4;
+				}
+			}
+			else
+			{
+			ROS_INFO("Calling RRT* Path Planner service");
 			if(cli_rrts.call(srv_rrts))
 			{
-				ROS_INFO("Path found: Publishing...");
 				pathsize = srv_rrts.response.path.size();
+				// Empty path: goal could not be connected safely
+				if(pathsize==0)
+				{
+					ROS_INFO("No valid path to the goal");
+				}
+				else
+				{
+				ROS_INFO("Path found: Publishing...");
 				// Obtain trajectory point-by-point
 				geometry_msgs::Vector3 point;
 				rrtPath.path.clear();
@@ -406,60 +937,110 @@ int main(int argc, char **argv)
 					ROS_INFO("Point %d: (%f,%f)",
 					i,point.x, point.y);
 				}
-				path_pub.publish(rrtPath);
 				state = 4;
+				}
 			}
 			else
 			{
 				ROS_ERROR("Failed to call RRT* Path Planner");
-				return 1;
+				state = 0;
+			}
 			}
 			}
+			if(state==3) state = 0; // No candidate reached
 
-			// If everything went well, miro turns itself to goal
-			// (only if it is not moving)
-			if(state==4)
+			// If everything went well (and no command preempted the
+			// look meanwhile), publish path and miro turns itself to
+			// goal (only if it is not moving). Decided under the
+			// command lock, so that a look whose path is published is
+			// not reported preempted, nor enabled after a stop
+			std::unique_lock<std::mutex> lock(cmd_mutex);
+			bool preempted = preempt;
+			if(state==4 && !preempted)
 			{
+				if(navigation) field_pub.publish(field);
+				else path_pub.publish(rrtPath);
 				ROS_INFO("Look, MiRo!");
+				if(first_look)
+				{
+					ROS_INFO("First look done %.2f s after start "
+					"(look took %.2f s)",
+					(ros::WallTime::now()-boot).toSec(),
+					(ros::WallTime::now()-look_start).toSec());
+					first_look = false;
+				}
 				dtheta = atan2(goal.y-robot.y,goal.x-robot.x) 
 								- robot.theta;
 				dtheta = atan2(sin(dtheta),cos(dtheta));
 				cmd_turn.body_move.theta = dtheta;
 				miro_pub.publish(cmd_turn);
+
+				// Go was part of the query: enable robot control
+				if(cmd.command==cmd.GO && !stopped)
+				{
+					enable.data = true;
+					flag_pub.publish(enable);
+				}
 			}
+			lock.unlock();
 
-			// Reset command
-			cmd.data = 0;
+			// Report the outcome to the command source
+			if(preempted)
+			{
+				ROS_INFO("Look preempted");
+				endCmd(cmd, miro_teleop::CommandAck::PREEMPTED);
+			}
+			else if(state==4)
+			endCmd(cmd, miro_teleop::CommandAck::DONE);
+			else
+			endCmd(cmd, miro_teleop::CommandAck::FAILED);
 		}
 
 		/* Command: go */
-		if(cmd.data==2)
+		else if(cmd.command==cmd.GO)
 		{
-			// Enable robot control
-			enable.data = true;
-			flag_pub.publish(enable);
-
-			// Reset command
-			cmd.data = 0;
+			// Enable robot control, unless stopped meanwhile
+			std::unique_lock<std::mutex> lock(cmd_mutex);
+			bool preempted = preempt || stopped;
+			if(!preempted)
+			{
+				enable.data = true;
+				flag_pub.publish(enable);
+			}
+			lock.unlock();
+			endCmd(cmd, preempted ? miro_teleop::CommandAck::PREEMPTED
+					      : miro_teleop::CommandAck::DONE);
 		}
 
 		/* Command: stop */
-		if(cmd.data==3)
+		else if(cmd.command==cmd.STOP)
 		{
-			// Disable robot control
+			// Disable robot control (already done on receipt)
 			enable.data = false;
 			flag_pub.publish(enable);
-
-			// Reset command
-			cmd.data = 0;
+			endCmd(cmd, miro_teleop::CommandAck::DONE);
 		}
 
-		/* Spin and wait for next period */
-		ros::spinOnce();
-		loop_rate.sleep();
-
+		/* Unknown command: ignored */
+		else
+		endCmd(cmd, miro_teleop::CommandAck::FAILED);
 	}
 
 	return 0;
 
 }
+
+} // namespace command_logic
+
+#ifndef MIRO_TELEOP_COMPONENT
+/**
+ * Command Logic Node main function.
+ * Initializes the node and runs the main loop until shutdown.
+ */
+int main(int argc, char **argv)
+{
+	ros::init(argc, argv, "command_logic");
+	ros::NodeHandle n, pn("~");
+	return command_logic::run(n, pn);
+}
+#endif
@@ -1,15 +1,20 @@
 /* Libraries */
 #include "ros/ros.h"
+#include "miro_teleop/components.h"
+#include "miro_teleop/grid.h"
 #include "tf/tf.h"
 #include "tf/transform_datatypes.h"
 #include "miro_teleop/GestureProcessing.h"
 #include <cmath>
 
+namespace gesture_processing {
+
 /* Definitions */
-#define HSIZE 400
-#define VSIZE 400
 #define H 80 // Height of the plane (in cm) with respect to the referential
 
+/* Workspace geometry (loaded at startup) */
+miro_teleop::Workspace ws;
+
 /**
  * Gesture Processing Service function.
  * From gesture pose, identifies the pointed position on the plane.
@@ -55,8 +60,8 @@ bool findTarget(miro_teleop::GestureProcessing::Request  &req,
 	{
 		ROS_INFO("Invalid gesture");
 		// Send a position out of the bounds
-		res.target.x = 2*HSIZE;
-		res.target.y = 2*VSIZE;
+		res.target.x = 2*ws.width;
+		res.target.y = 2*ws.height;
 		res.target.theta = 0;
 	}
 	else
@@ -76,18 +81,34 @@ bool findTarget(miro_teleop::GestureProcessing::Request  &req,
 	return true;
 }
 
+/* Service handle, kept for the lifetime of the node */
+ros::ServiceServer service;
+
+/**
+ * Gesture Processing Service setup.
+ * Loads the workspace geometry and advertises the service.
+ */
+void setup(ros::NodeHandle& n, ros::NodeHandle& pn)
+{
+	ws = miro_teleop::Workspace::load(n);
+	service = n.advertiseService("gesture_processing", findTarget);
+	ROS_INFO("Gesture processing service active");
+}
+
+} // namespace gesture_processing
+
+#ifndef MIRO_TELEOP_COMPONENT
 /**
  * Gesture Processing Service Main function.
- * Initializes and advertises the service.
+ * Initializes the node and serves its callbacks.
  */
 int main(int argc, char **argv)
 {
 	ros::init(argc, argv, "gesture_processing_server");
-	ros::NodeHandle n;
-	ros::ServiceServer service = 
-			n.advertiseService("gesture_processing", findTarget);
-	ROS_INFO("Gesture processing service active");
+	ros::NodeHandle n, pn("~");
+	gesture_processing::setup(n, pn);
 	ros::spin();
 
 	return 0;
 }
+#endif
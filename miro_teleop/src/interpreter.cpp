@@ -1,62 +1,380 @@
 /* Libraries */
 #include "ros/ros.h"
-#include "std_msgs/UInt8.h"
+#include "miro_teleop/components.h"
+#include "std_msgs/Time.h"
+#include "std_msgs/Float64.h"
+#include "miro_teleop/Command.h"
+#include "miro_teleop/CommandAck.h"
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
+#include <cctype>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <sys/stat.h>
+
+namespace interpreter {
+
+/* Definitions */
+#define NZ 5 // Number of relations (north, west, south, east, distance-to)
+#define NLETTERS 26 // Trie branching (words are lowercase letters only)
+#define ACK_TIMEOUT 0.3 // Time before an unacknowledged command is resent (s)
+#define MAX_TRIES 3 // Number of times a command is sent before giving up
+
+/* Word classes of the command grammar */
+#define WORD_COMMAND 1 // Value is the command tag sent to the master
+#define WORD_RELATION 2 // Value is a mask of directions (bit dir)
+#define WORD_DISTANCE 3 // Value is the distance-to weight (near 1, far 0)
+
+/* Keyword table: words, their class and value */
+struct Keyword
+{
+	const char* word;
+	unsigned char type;
+	unsigned char value;
+};
+
+const Keyword keywords[] =
+{
+	{"look",      WORD_COMMAND,  1},
+	{"go",        WORD_COMMAND,  2},
+	{"stop",      WORD_COMMAND,  3},
+	{"halt",      WORD_COMMAND,  3},
+	// Directions, in the order of the spatial reasoner landscapes
+	{"north",     WORD_RELATION, 1<<0},
+	{"west",      WORD_RELATION, 1<<1},
+	{"south",     WORD_RELATION, 1<<2},
+	{"east",      WORD_RELATION, 1<<3},
+	{"northwest", WORD_RELATION, 1<<0|1<<1},
+	{"southwest", WORD_RELATION, 1<<2|1<<1},
+	{"southeast", WORD_RELATION, 1<<2|1<<3},
+	{"northeast", WORD_RELATION, 1<<0|1<<3},
+	// Distance qualifiers
+	{"near",      WORD_DISTANCE, 1},
+	{"close",     WORD_DISTANCE, 1},
+	{"beside",    WORD_DISTANCE, 1},
+	{"next",      WORD_DISTANCE, 1},
+	{"far",       WORD_DISTANCE, 0},
+	{"away",      WORD_DISTANCE, 0}
+};
+
+const int NKEYWORDS = sizeof(keywords)/sizeof(keywords[0]);
+
+/* Trie node: one child per letter, and the keyword ending here (if any) */
+struct TrieNode
+{
+	int next[NLETTERS]; // 0 if no child (the root is never a child)
+	int keyword; // Index in the keyword table, -1 if none
+};
+
+/* Command sent and not yet acknowledged by the master */
+struct Pending
+{
+	miro_teleop::Command cmd;
+	ros::WallTime sent;
+	int tries;
+};
+
+/* Global variables */
+std::vector<TrieNode> trie; // Keyword trie, built once at startup
+ros::Publisher cmd_pub; // Commands to the master
+ros::Publisher stop_pub; // High-priority (latched) stop, stamped at input
+unsigned int seq = 0; // Sequence number of the last command sent
+std::map<unsigned int, Pending> pending; // Unacknowledged, by sequence
+std::mutex pending_mutex; // Input thread vs. acknowledgements and resends
 
 /**
- * Command Interpreter Node main function.
- * Obtains speech from user and translate them into commands.
+ * Builds the keyword trie from the keyword table.
+ * Done once, so that parsing a line only walks the trie letter by letter.
+ */
+void buildTrie()
+{
+	TrieNode empty;
+	for (int c=0;c<NLETTERS;c++) empty.next[c] = 0;
+	empty.keyword = -1;
+
+	trie.assign(1, empty);
+	for (int k=0;k<NKEYWORDS;k++)
+	{
+		int node = 0;
+		for (const char* c=keywords[k].word;*c;c++)
+		{
+			int l = *c-'a';
+			if (trie[node].next[l] == 0)
+			{
+				trie[node].next[l] = trie.size();
+				trie.push_back(empty);
+			}
+			node = trie[node].next[l];
+		}
+		trie[node].keyword = k;
+	}
+}
+
+/**
+ * Parses one input line into a command and its spatial relations.
+ *
+ * Words are runs of letters (case is ignored), anything else separates them.
+ * Each word is matched by walking the trie while it is read. The first
+ * command word gives the command; relation words select the directions,
+ * with the same weight each; distance words set the weight of the
+ * distance-to relation, which is 1 (as with gestures) unless "far" is said.
+ * Any other word is ignored, e.g. "go north of the box, near it".
  *
- * The command strings input by the user (typed in the terminal) are mapped to 
- * flags (integer values) and sent to the Command Logic Node.
+ * A phrase with relations and no command word is taken as a look.
  *
- * If sentences are received, parsing the text is necessary, which must be done
- * by calling the Speech Recognition Node (currently in development).
+ * @param line Input line
+ * @param query Parsed command and relation weights (empty if no relation)
  */
-int main(int argc, char **argv)
+void parse(const std::string& line, miro_teleop::Command& query)
 {
-	/* Definitions */
- 	std_msgs::UInt8 msg; // Command tag associated and published.
- 	std::string cmd; // Command string parsed by speech recognition.
+	unsigned char relations = 0;
+	double distance = 1;
+	int node = 0;
 
-	/* Initialize and assign node handler */
-	ros::init(argc, argv, "interpreter");
-	ros::NodeHandle n;
+	query.command = 0;
+	query.weights.clear();
 
-	/* Initialize publisher */
-	ros::Publisher cmd_pub = 
-		n.advertise<std_msgs::UInt8>("command", 1);
+	// Walk one past the end, so that the last word is also terminated
+	for (int i=0;i<=line.size();i++)
+	{
+		char c = i<line.size() ? std::tolower(line[i]) : ' ';
+		if (c>='a' && c<='z')
+		{
+			if (node >= 0) node = trie[node].next[c-'a'];
+			if (node == 0) node = -1; // No keyword with this prefix
+			continue;
+		}
+		// End of word: check whether a keyword ends at this node
+		if (node > 0 && trie[node].keyword >= 0)
+		{
+			const Keyword& k = keywords[trie[node].keyword];
+			if (k.type == WORD_COMMAND && query.command == 0)
+				query.command = k.value;
+			else if (k.type == WORD_RELATION)
+				relations |= k.value;
+			else if (k.type == WORD_DISTANCE)
+				distance = k.value;
+		}
+		node = 0;
+	}
 
-	/* Update rate (period) */
-  	ros::Rate loop_rate(10);
+	if (relations == 0 || query.command == query.STOP) return;
+	if (query.command == 0) query.command = query.LOOK;
 
- 	ROS_INFO("Command Interpreter node active");
+	std_msgs::Float64 weight;
+	for (int dir=0;dir<NZ-1;dir++)
+	{
+		weight.data = (relations>>dir)&1;
+		query.weights.push_back(weight);
+	}
+	weight.data = distance;
+	query.weights.push_back(weight);
+}
 
-	/* Main loop */
-	while (ros::ok())
+/**
+ * Parses one input line and publishes the command found.
+ *
+ * Commands carry a sequence number and a priority (stop over go over look),
+ * so that the master can serve the most urgent first and preempt a look in
+ * progress. A look or go with spatial relations also carries the relation
+ * weights, so that the master can map the landscapes from them instead of
+ * the gesture. Each command is kept until the master acknowledges it.
+ *
+ * A stop is also published right away on the high-priority topic, with the
+ * input time as stamp, so that the controller can halt the robot without
+ * going through the master and can measure the stop latency.
+ */
+void dispatch(const std::string& line)
+{
+	miro_teleop::Command cmd;
+
+	parse(line, cmd);
+
+	/* Publish only in case something meaningful was received */
+	if (cmd.command == 0) return;
+
+	if (cmd.command == cmd.STOP)
 	{
-		/* Receiving input from the user */
-		std::cout << "Awaiting command: ";
-		std::cin >> cmd;
+		std_msgs::Time stop;
+		stop.data = ros::Time::now();
+		stop_pub.publish(stop);
+	}
 
-		/* Command-tag mapping */
-		if (!cmd.compare("look")) msg.data = 1;
-		else if (!cmd.compare("go")) msg.data = 2;
-		else if (!cmd.compare("stop")) msg.data = 3;
-		else msg.data = 0;
+	cmd.source = ros::this_node::getName();
+	if (cmd.command == cmd.STOP) cmd.priority = cmd.PRIORITY_STOP;
+	else if (cmd.command == cmd.GO) cmd.priority = cmd.PRIORITY_GO;
+	else cmd.priority = cmd.PRIORITY_LOOK;
 
-		/* Publish only in case something meaningful was received */
-		if(msg.data>0)
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	cmd.seq = ++seq;
+	Pending& p = pending[cmd.seq];
+	p.cmd = cmd;
+	p.sent = ros::WallTime::now();
+	p.tries = 1;
+	cmd_pub.publish(cmd);
+
+	if (cmd.weights.empty())
+		ROS_INFO("Sent command %u: [%d] to master", cmd.seq, cmd.command);
+	else
+		ROS_INFO("Sent command %u: [%d] to master, weights "
+			"(%.0f %.0f %.0f %.0f) distance %.0f", cmd.seq, cmd.command,
+			cmd.weights[0].data, cmd.weights[1].data,
+			cmd.weights[2].data, cmd.weights[3].data,
+			cmd.weights[NZ-1].data);
+}
+
+/**
+ * Subscriber callback function.
+ * Obtains the acknowledgements of the commands from the master.
+ *
+ * A command is delivered once received; its outcome is reported later.
+ */
+void getAck(const miro_teleop::CommandAck::ConstPtr& ack)
+{
+	if (ack->source != ros::this_node::getName()) return;
+
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	if (ack->status == ack->RECEIVED)
+	{
+		std::map<unsigned int, Pending>::iterator p = pending.find(ack->seq);
+		if (p == pending.end()) return;
+		ROS_INFO("Command %u received by master in %.1f ms", ack->seq,
+			(ros::WallTime::now()-p->second.sent).toSec()*1000);
+		pending.erase(p);
+	}
+	else if (ack->status == ack->DONE)
+		ROS_INFO("Command %u done", ack->seq);
+	else if (ack->status == ack->PREEMPTED)
+		ROS_INFO("Command %u preempted", ack->seq);
+	else
+		ROS_INFO("Command %u failed", ack->seq);
+}
+
+/**
+ * Timer callback function.
+ * Resends the commands not acknowledged in time, up to MAX_TRIES times.
+ */
+void resend(const ros::WallTimerEvent&)
+{
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	ros::WallTime now = ros::WallTime::now();
+	std::map<unsigned int, Pending>::iterator p = pending.begin();
+	while (p != pending.end())
+	{
+		if ((now-p->second.sent).toSec() < ACK_TIMEOUT) { p++; continue; }
+		if (p->second.tries >= MAX_TRIES)
 		{
-			cmd_pub.publish(msg);
-			ROS_INFO("Sent command: [%s] to master",cmd.data());
+			ROS_ERROR("Command %u not acknowledged by master", p->first);
+			pending.erase(p++);
+			continue;
 		}
+		cmd_pub.publish(p->second.cmd);
+		p->second.sent = now;
+		p->second.tries++;
+		p++;
+	}
+}
 
-		/* Spin and wait for next period */
-		ros::spinOnce();
-		loop_rate.sleep();
+/**
+ * Input thread function.
+ * Reads command lines from the terminal, or from a local file/FIFO if an
+ * input path is given, and dispatches them as soon as they are complete.
+ *
+ * A FIFO is reopened whenever its writer closes it; a regular file is read
+ * once.
+ */
+void readCommands(std::string input)
+{
+	std::string line;
+
+	if (input.empty())
+	{
+		std::cout << "Awaiting command: " << std::flush;
+		while (ros::ok() && std::getline(std::cin, line))
+		{
+			dispatch(line);
+			std::cout << "Awaiting command: " << std::flush;
+		}
+		return;
 	}
-	
+
+	struct stat info;
+	bool fifo = stat(input.c_str(), &info)==0 && S_ISFIFO(info.st_mode);
+	do
+	{
+		std::ifstream stream(input.c_str());
+		if (!stream.is_open())
+		{
+			ROS_ERROR("Cannot open command input %s", input.c_str());
+			return;
+		}
+		while (ros::ok() && std::getline(stream, line)) dispatch(line);
+	}
+	while (fifo && ros::ok());
+}
+
+/* Handles kept for the lifetime of the node */
+ros::Subscriber ack_sub;
+ros::WallTimer timer;
+
+/**
+ * Command Interpreter Node setup.
+ * Obtains speech from user and translate them into commands.
+ *
+ * The command strings input by the user (typed in the terminal, or written
+ * to the file given by the ~input parameter) are mapped to flags (integer
+ * values) and sent to the Command Logic Node. Phrases stating where to go,
+ * such as "look north of the box", are sent as spatial queries instead.
+ *
+ * Input is read on its own thread, so each command is published as soon as
+ * its line is complete instead of waiting for the next loop period. Stop is
+ * additionally sent on the latched "stop" topic.
+ *
+ * Sentences are parsed with a small keyword grammar; spoken commands are
+ * spotted by the Speech Recognition Node instead.
+ */
+void setup(ros::NodeHandle& n, ros::NodeHandle& pn)
+{
+	/* Definitions */
+	std::string input; // Command source (terminal if empty)
+
+	pn.param("input", input, std::string(""));
+
+	/* Initialize publishers and subscribers */
+	cmd_pub = n.advertise<miro_teleop::Command>("command", 10);
+	stop_pub = n.advertise<std_msgs::Time>("stop", 1, true);
+	ack_sub = n.subscribe("command_ack", 10, getAck);
+
+	/* Resend unacknowledged commands */
+	timer = n.createWallTimer(ros::WallDuration(ACK_TIMEOUT/3), resend);
+
+ 	ROS_INFO("Command Interpreter node active");
+
+	buildTrie();
+
+	/* Input thread, blocked on reads until shutdown */
+	std::thread reader(readCommands, input);
+	reader.detach();
+}
+
+} // namespace interpreter
+
+#ifndef MIRO_TELEOP_COMPONENT
+/**
+ * Command Interpreter Node main function.
+ * Initializes the node and serves its callbacks.
+ */
+int main(int argc, char **argv)
+{
+	ros::init(argc, argv, "interpreter");
+	ros::NodeHandle n, pn("~");
+	interpreter::setup(n, pn);
+	ros::spin();
+
 	return 0;
 }
+#endif
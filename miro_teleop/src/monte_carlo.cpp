@@ -1,37 +1,58 @@
 /* Libraries */
 #include "ros/ros.h"
+#include "miro_teleop/components.h"
+#include "miro_teleop/grid.h"
+#include "miro_teleop/footprint.h"
+#include "miro_teleop/regions.h"
 #include "miro_teleop/MonteCarlo.h"
+#include "miro_teleop/MonteCarloConfig.h"
+#include <dynamic_reconfigure/server.h>
 #include <cstdio>
 #include <cmath>
 #include <map>
+#include <vector>
+#include <mutex>
 #include <boost/random.hpp>
 #include <boost/random/normal_distribution.hpp>
 #include <boost/random/uniform_real_distribution.hpp>
 
-/* Constants */
-#define HSIZE 400 // Horizontal map size (in cm)
-#define VSIZE 400 // Vertical map size (in cm)
-#define RES 40 // Grid resolution
-#define PERT_THRESH 0.5 // Minimum acceptable output pertinence
-#define LIMIT 10000 // Limit simulation rounds (timeout constraint)
+namespace monte_carlo {
 
-/** 
- * Method to quantize the coordinates of a point to indexes of a discretized 
- * matrix, along a particular dimension.
+/* Settings, reconfigurable at run time (see cfg/MonteCarlo.cfg) */
+miro_teleop::MonteCarloConfig config;
+std::mutex config_mutex; // Reconfiguration vs. requests in progress
+
+/* Random number generator, seeded once at startup */
+boost::mt19937 rng;
+
+/* Workspace discretization (loaded at startup) */
+miro_teleop::Workspace ws;
+
+/**
+ * Goal region around a goal: box of the component of pertinent, clear
+ * positions containing it, grown from the goal cell (see componentBox()),
+ * so that every cell of the region is pertinent and keeps the clearance.
  *
- * @param x Current value
- * @param xmin Minimum value
- * @param xmax Maximum value
- * @param quantum Increment
+ * @param x Goal x
+ * @param y Goal y
+ * @param labels Component of each cell (see connectedComponents())
+ * @param region Output, null size if the goal is in no component
  */
-int quantize(float x, float xmin, float xmax, float quantum)
+void goalRegion(double x, double y, const miro_teleop::Grid<int>& labels,
+		rrtstar_msgs::Region& region)
 {
-  	int n = ceil((xmax-xmin)/quantum);
-  	int posOrigin = ceil(n/2.0)-1;
-  	float delta = 0;
-  	if (n%2 != 0) delta = quantum/2.0;
-  	int index = posOrigin + ceil((x-delta)/quantum);
-  	return index;
+	region = rrtstar_msgs::Region();
+	if(labels(ws.col(x), ws.row(y))<0) return;
+	miro_teleop::Component c;
+	miro_teleop::componentBox(labels, ws.col(x), ws.row(y),
+				  c.i0, c.j0, c.i1, c.j1);
+
+	// From the lowest cell to the highest, borders included
+	double cw = ws.width/ws.cols, ch = ws.height/ws.rows;
+	region.center_x = (ws.x(c.i0)+ws.x(c.i1))/2;
+	region.center_y = (ws.y(c.j0)+ws.y(c.j1))/2;
+	region.size_x = (c.i1-c.i0+1)*cw;
+	region.size_y = (c.j1-c.j0+1)*ch;
 }
 
 /**
@@ -43,48 +64,108 @@ int quantize(float x, float xmin, float xmax, float quantum)
  * positions within the workspace grid. 
  * 
  * The position with maximum value is returned, if sufficiently pertinent.
+ * All the positions are scored first, so that the timeout is returned at
+ * once when none of them is.
+ *
+ * Positions are scored by the average pertinence over the goal region
+ * centered on them (the footprint), and only if the region keeps the
+ * minimum clearance to the obstacles and walls, so that the planner is not
+ * given a goal it can barely reach. The summed-area table of the landscape
+ * and the clearance map are built once per request, after which each
+ * position is scored in constant time.
+ *
+ * Alternate goals are returned along with the best one: the peaks of the
+ * scores, ranked and kept only if far enough from the goals already kept
+ * (non-maximum suppression), so that a goal the planner cannot reach can
+ * be replaced without another request.
+ *
+ * Each goal comes with a goal region for the planner: the pertinent
+ * positions (scoring at least the threshold, and keeping the clearance)
+ * are split into connected components, and a box of the one containing the
+ * goal is grown around it. The planner connects its paths to the goal from
+ * anywhere in the region, which lets them approach the goal from its
+ * pertinent side.
  */
 bool MCSimulation(miro_teleop::MonteCarlo::Request  &req,
   		  miro_teleop::MonteCarlo::Response &res)
 {
-   	int iters = 1000, batch = 1, max_x, max_y, count = 0;
-    	float quantum = HSIZE/RES, sdx = RES, sdy = RES, rx, ry, 
-		xmin=-HSIZE/2, xmax=HSIZE/2, ymin=-VSIZE/2, ymax=VSIZE/2;
-    	float max_obj = 0, obj;
+   	int iters = 1000, batch = 1, count = 0;
+    	// Settings of this request, reconfigured ones apply to the next
+    	config_mutex.lock();
+    	const double pert_thresh = config.pert_thresh;
+    	const int limit = config.limit;
+    	const double clearance = config.clearance;
+    	const int k = req.candidates>0 ? req.candidates : config.candidates;
+    	const double separation = config.separation;
+    	config_mutex.unlock();
+
+    	float rx, ry, xmin=-ws.width/2, xmax=ws.width/2,
+		ymin=-ws.height/2, ymax=ws.height/2;
+    	float max_x = 0, max_y = 0, max_obj = 0, obj;
 
     	// Obtain input request data
-    	std_msgs::Float64 landscape[RES*RES];
-    	for(int i=0;i<req.landscape.size();i++)
-    	landscape[i].data = req.landscape[i].data;
+    	miro_teleop::Grid<double> landscape;
+    	miro_teleop::fromMsg(req.landscape, ws.cols, ws.rows, landscape);
+    	if(landscape.layers!=1)
+    	{
+    		ROS_ERROR("Expected a landscape of %dx%d", ws.cols, ws.rows);
+    		return false;
+    	}
 
-    	boost::mt19937 *rng = new boost::mt19937();
+    	// Footprint scores: goal region and obstacles from the request
+    	std::vector<miro_teleop::Box> obstacles;
+    	for(int o=0;o<req.obstacles.size();o++)
+    		obstacles.push_back(miro_teleop::Box(req.obstacles[o].center_x,
+    			req.obstacles[o].center_y, req.obstacles[o].size_x,
+    			req.obstacles[o].size_y));
+    	double fw = 0, fh = 0;
+    	if(req.footprint.size()==2)
+    	{
+    		fw = req.footprint[0].data;
+    		fh = req.footprint[1].data;
+    	}
+    	miro_teleop::FootprintScore score(ws, landscape, obstacles,
+    					  fw, fh, clearance);
 
-      	rng->seed(time(NULL));
+    	// Scores of all the cells: if none reaches the threshold, no draw
+    	// can, so the timeout is returned without drawing
+    	miro_teleop::Grid<double> S;
+    	score.map(S);
+    	double max_S = 0;
+    	for(int c=0;c<S.size();c++)
+    		if(S.data[c]>max_S && S.data[c]<=1) max_S = S.data[c];
+    	if(max_S<pert_thresh)
+    	{
+    		ROS_INFO("No position scores %.2f (best %.2f)", pert_thresh,
+    			 max_S);
+    		// Return out-of-bound numbers as a timeout flag
+    		res.goal.x = 2*ws.width;
+    		res.goal.y = 2*ws.height;
+    		return true;
+    	}
 
-    	// Uniform Distribution
+    	// Uniform Distribution (drawing from the shared generator)
     	boost::random::uniform_real_distribution<> distx(xmin, xmax);
-    	boost::variate_generator< boost::mt19937,	
-		boost::random::uniform_real_distribution<> > dx(*rng, distx);
+    	boost::variate_generator< boost::mt19937&,	
+		boost::random::uniform_real_distribution<> > dx(rng, distx);
+    	boost::random::uniform_real_distribution<> disty(ymin, ymax);
+    	boost::variate_generator< boost::mt19937&,	
+		boost::random::uniform_real_distribution<> > dy(rng, disty);
     
-	while(max_obj<PERT_THRESH)
+	while(max_obj<pert_thresh)
 	{
       		for (int i = 1; i <= iters; i++) 
 		{
         		rx=dx();
-        		ry=dx();
+        		ry=dy();
         		std::cout<<"Random point generated at ("<<rx<<","<<
 								  ry<<") ";
         		// Excluding points on and outside the boundary
         		if(rx>xmin && rx<xmax && ry>ymin && ry<ymax)
 			{
-          			int ncols = ceil((xmax-xmin)/quantum);
-          			int nrows = ceil((ymax-ymin)/quantum);
-          			int index_x = quantize(rx, xmin, xmax, quantum);
-          			int index_y = (nrows-1-quantize(ry, ymin, ymax,
-								     quantum)); 
-				// Inverting to maintain mapping consistency 
-				// with matrix formed by pertinence mapper
-          			obj = landscape[index_y*ncols + index_x].data;
+          			int index_x = ws.col(rx);
+          			int index_y = ws.row(ry);
+          			obj = score(index_x, index_y);
           			std::cout<<"val = "<<obj<<std::endl;
           			if(obj>1)
 				{
@@ -100,12 +181,12 @@ bool MCSimulation(miro_teleop::MonteCarlo::Request  &req,
         		}
       		}
       		count++;
-      		if(count>=LIMIT)
+      		if(count>=limit)
       		{
         		ROS_INFO("Timeout: maximum number of rounds exceeded");
         		// Return out-of-bound numbers as a timeout flag
-			res.goal.x = 2*HSIZE;
-			res.goal.y = 2*VSIZE;
+			res.goal.x = 2*ws.width;
+			res.goal.y = 2*ws.height;
         		return true;
       		}
    	}
@@ -114,21 +195,97 @@ bool MCSimulation(miro_teleop::MonteCarlo::Request  &req,
     	res.goal.y = max_y;
     	ROS_INFO("Goal position: (%f,%f) with val=%f", res.goal.x, res.goal.y, 
 								     max_obj);
+
+    	// Alternates: separated peaks of the scores, after the goal
+    	std::vector<double> kept(2);
+    	std::vector<miro_teleop::Candidate> peaks;
+    	kept[0] = res.goal.x;
+    	kept[1] = res.goal.y;
+    	miro_teleop::goalCandidates(ws, S, pert_thresh, k-1, separation,
+    				    kept, peaks);
+    	res.candidates.push_back(res.goal);
+    	for(int p=0;p<peaks.size();p++)
+    	{
+    		geometry_msgs::Pose2D alt;
+    		alt.x = ws.x(peaks[p].i);
+    		alt.y = ws.y(peaks[p].j);
+    		res.candidates.push_back(alt);
+    		ROS_INFO("Alternate goal: (%f,%f) with val=%f", alt.x, alt.y,
+    			 peaks[p].score);
+    	}
+
+    	// Goal regions: components of the pertinent positions keeping the
+    	// clearance (whatever the threshold)
+    	miro_teleop::Grid<int> labels;
+    	std::vector<miro_teleop::Component> components;
+    	for(int c=0;c<S.size();c++)
+    		if(score.clearance.data[c]<clearance) S.data[c] = -1;
+    	miro_teleop::connectedComponents(S, pert_thresh, labels, components);
+    	res.regions.resize(res.candidates.size());
+    	for(int c=0;c<res.candidates.size();c++)
+    	{
+    		goalRegion(res.candidates[c].x, res.candidates[c].y, labels,
+    			   res.regions[c]);
+    		ROS_INFO("Goal region %d: %.0fx%.0f cm", c,
+    			 res.regions[c].size_x, res.regions[c].size_y);
+    	}
     	return true;
 }
 
+/**
+ * Reconfiguration callback function.
+ * Takes the new settings, used from the next request on.
+ */
+void reconfigure(miro_teleop::MonteCarloConfig& c, uint32_t level)
+{
+    	std::lock_guard<std::mutex> lock(config_mutex);
+    	config = c;
+    	ROS_INFO("Reconfigured: threshold %.2f, limit %d rounds, "
+		 "clearance %.0f cm, %d candidates %.0f cm apart",
+		 config.pert_thresh, config.limit, config.clearance,
+		 config.candidates, config.separation);
+}
+
+/* Handles kept for the lifetime of the node */
+ros::ServiceServer service;
+dynamic_reconfigure::Server<miro_teleop::MonteCarloConfig>* config_server;
+
+/**
+ * Monte Carlo Simulation Service setup.
+ * Loads the workspace geometry, seeds the generator and advertises the
+ * service. The threshold, the round limit, the clearance and the goal
+ * candidates are served by dynamic_reconfigure under pn.
+ */
+void setup(ros::NodeHandle& n, ros::NodeHandle& pn)
+{
+    	ws = miro_teleop::Workspace::load(n);
+    	config_server =
+		new dynamic_reconfigure::Server<miro_teleop::MonteCarloConfig>(pn);
+    	config_server->setCallback(reconfigure);
+
+    	// Prewarm: seed the generator (and draw its first state) before
+    	// advertising, which signals that the server is ready
+    	rng.seed(time(NULL));
+    	rng.discard(624);
+
+    	service = n.advertiseService("monte_carlo", MCSimulation);
+    	ROS_INFO("Monte Carlo Simulation service active");
+}
+
+} // namespace monte_carlo
+
+#ifndef MIRO_TELEOP_COMPONENT
 /**
  * Monte Carlo Simulation Service Main function.
- * Initializes and advertises the service.
+ * Initializes the node and serves its callbacks.
  */
 int main(int argc, char **argv)
 {
-    	ros::init(argc, argv, "monte_carlo_server");
-    	ros::NodeHandle n;
-    	ros::ServiceServer service =
-    		n.advertiseService("monte_carlo", MCSimulation);
-    	ROS_INFO("Monte Carlo Simulation service active");
-    	ros::spin();
+	ros::init(argc, argv, "monte_carlo_server");
+	ros::NodeHandle n, pn("~");
+	monte_carlo::setup(n, pn);
+	ros::spin();
 
-    	return 0;
+	return 0;
 }
+#endif
@@ -1,17 +1,25 @@
 /* Libraries */
 #include "ros/ros.h"
+#include "miro_teleop/components.h"
+#include "miro_teleop/landscape.h"
 #include "miro_teleop/PertinenceMapping.h"
+#include "miro_teleop/PertinenceMappingConfig.h"
+#include <dynamic_reconfigure/server.h>
 #include <cstdio>
 #include <cmath>
+#include <vector>
+#include <mutex>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
-/* Constants */
-#define HSIZE 400 // Horizontal map size (in cm)
-#define VSIZE 400 // Vertical map size (in cm)
-#define NZ 5 // Number of zones
-#define RES 40 // Grid resolution
-#define GAMMA 2.0 // Scaling factor for target pertinences
+namespace pertinence_mapping {
+
+/* Settings, reconfigurable at run time (see cfg/PertinenceMapping.cfg) */
+miro_teleop::PertinenceMappingConfig config;
+std::mutex config_mutex; // Reconfiguration vs. requests in progress
+
+/* Workspace discretization (loaded at startup) */
+miro_teleop::Workspace ws;
 
 /**
  * Pertinence Mapping Service function.
@@ -20,82 +28,164 @@
  * With all the matrices generated by the Spatial Reasoner, this service
  * performs an element-wise mathematical operation to obtain a landscape
  * that is parameterized by the information given by the target pointed.
+ *
+ * If relation weights are given instead (from a spatial query), they are used
+ * directly as the direction pertinences, and the last one sets how much the
+ * distance-to landscape constrains the result (1 as with gestures, 0 not at
+ * all).
  * 
  * Then, a normalization is done to maintain the elements in the range [0,1].
+ *
+ * The direction landscapes premultiplied by the distance-to one come with
+ * the request (from the spatial reasoner), so that the mapping is a
+ * weighted sum of at most 4 landscapes; they are computed here otherwise.
+ *
+ * Several targets may be given at once (e.g. samples around a noisy
+ * gesture), in which case one landscape is returned per target, or their
+ * per-cell maximum if asked to combine them. All are mapped in one pass
+ * over the landscapes (see mapPertinencesBatch()).
  */
 bool PertinenceMapper(miro_teleop::PertinenceMapping::Request  &req,
          	      miro_teleop::PertinenceMapping::Response &res)
 {
 	/* Input 3-D matrix to be processed (received from master) */
-	std_msgs::Float64 matrices[NZ*RES*RES];
+	miro_teleop::Grid<double> matrices;
 
-	/* Landscape matrix to be returned (mapped into an 1-D array) */
-	std_msgs::Float64 landscape[RES*RES];
+	/* Premultiplied landscapes and maxima of all */
+	miro_teleop::Grid<double> premultiplied;
+	double maxima[2*(NZ-1)];
 
-	double max = 0;
+	/* Landscape matrix to be returned */
+	miro_teleop::Grid<double> landscape;
 
 	ROS_INFO("Request received from master node");
-	ROS_INFO("Target: (%f %f)",req.target.x,req.target.y);
+	if(req.weights.size()!=NZ && req.targets.empty())
+		ROS_INFO("Target: (%f %f)",req.target.x,req.target.y);
 
 	/* Obtain input from request */
-	for(int i=0;i<req.matrices.size();i++)
-		matrices[i].data = req.matrices[i].data;
-
-	/* Extract target coordinates and map to grid */
-	int Px = floor((req.target.x+HSIZE/2)*RES/HSIZE);
-	// Inverting y coordinate to match matrix ordering
-	int Py = RES-1-floor((req.target.y+VSIZE/2)*RES/VSIZE); 	
-	ROS_INFO("Target grid coordinates: [%d, %d]",Px,Py);
-
-	/* Calculate point pertinences from input landscapes */
-	double P[4];
-	for(int dir=0;dir<4;dir++) 
+	miro_teleop::fromMsg(req.matrices, ws.cols, ws.rows, matrices);
+	if(matrices.layers!=NZ)
+	{
+		ROS_ERROR("Expected %d landscapes of %dx%d",NZ,ws.cols,ws.rows);
+		return false;
+	}
+	miro_teleop::fromMsg(req.premultiplied, ws.cols, ws.rows, premultiplied);
+	if(premultiplied.layers==NZ-1 && req.maxima.size()==2*(NZ-1))
 	{
-    		P[dir] = pow(matrices[Px+RES*Py+RES*RES*dir].data,GAMMA);
-   		ROS_INFO("P[%d]=%f",dir,P[dir]);
-  	}
+		for(int i=0;i<2*(NZ-1);i++) maxima[i] = req.maxima[i].data;
+	}
+	else
+		miro_teleop::premultiply(matrices, premultiplied, maxima);
 
-	/* Perform mapping of all landscapes into one */
-  	// Note: i = columns, j = rows
-	for(int i=0;i<RES;i++)
+	/* Several targets: pertinences of each, mapped together */
+	if(req.weights.size()!=NZ && !req.targets.empty())
 	{
-		for(int j=0;j<RES;j++)
+		const int K = req.targets.size();
+		std::vector<double> P(K*(NZ-1));
+
+		config_mutex.lock();
+		double gamma = config.gamma; // Scaling factor
+		config_mutex.unlock();
+		for(int k=0;k<K;k++)
+			miro_teleop::targetPertinences(ws, matrices,
+				req.targets[k].x, req.targets[k].y, gamma,
+				&P[k*(NZ-1)]);
+
+		miro_teleop::mapPertinencesBatch(ws, matrices, premultiplied,
+						 maxima, P, 1, landscape);
+		if(req.combine)
 		{
-			landscape[i+RES*j].data =
-				(P[0]*matrices[i+RES*j].data +
-				 P[1]*matrices[i+RES*j+1*RES*RES].data +
-				 P[2]*matrices[i+RES*j+2*RES*RES].data +
-				 P[3]*matrices[i+RES*j+3*RES*RES].data)
-				*matrices[i+RES*j+(NZ-1)*RES*RES].data;
-			// For performing normalization
-			if(landscape[i+RES*j].data>max)
-				max = landscape[i+RES*j].data;
+			miro_teleop::Grid<double> combined;
+			miro_teleop::maxLayers(landscape, combined);
+			miro_teleop::toMsg(combined, res.landscape);
 		}
+		else
+			miro_teleop::toMsg(landscape, res.landscape);
+
+		ROS_INFO("Successfully mapped the pertinences of %d targets%s",
+			K, req.combine ? " (combined)" : "");
+		return true;
 	}
-	/* Attach obtained matrix to response */
-	for(int i=0;i<RES*RES;i++)
+
+	/* Calculate point pertinences from input landscapes */
+	double P[NZ-1], D = 1;
+	if(req.weights.size()==NZ)
+	{
+		/* Relation weights given by a spatial query */
+		for(int dir=0;dir<NZ-1;dir++)
+			P[dir] = req.weights[dir].data;
+		D = req.weights[NZ-1].data;
+	}
+	else
 	{
-		landscape[i].data = (landscape[i].data)/max;
-		res.landscape.push_back(landscape[i]);
+		/* Pertinences at the target cell */
+		ROS_INFO("Target grid coordinates: [%d, %d]",
+			ws.col(req.target.x),ws.row(req.target.y));
+		config_mutex.lock();
+		double gamma = config.gamma; // Scaling factor
+		config_mutex.unlock();
+		miro_teleop::targetPertinences(ws, matrices,
+			req.target.x, req.target.y, gamma, P);
 	}
+	for(int dir=0;dir<NZ-1;dir++) ROS_INFO("P[%d]=%f",dir,P[dir]);
+
+	/* Perform mapping of all landscapes into one, normalized */
+	miro_teleop::mapPertinences(ws, matrices, premultiplied, maxima,
+				    P, D, landscape);
+
+	/* Attach obtained matrix to response */
+	miro_teleop::toMsg(landscape, res.landscape);
 
 	ROS_INFO("Successfully mapped the pertinences");
 
   	return true;
 }
 
+/**
+ * Reconfiguration callback function.
+ * Takes the new settings, used from the next request on.
+ */
+void reconfigure(miro_teleop::PertinenceMappingConfig& c, uint32_t level)
+{
+	std::lock_guard<std::mutex> lock(config_mutex);
+	config = c;
+	ROS_INFO("Reconfigured: gamma %.2f", config.gamma);
+}
+
+/* Handles kept for the lifetime of the node */
+ros::ServiceServer service;
+dynamic_reconfigure::Server<miro_teleop::PertinenceMappingConfig>*
+	config_server;
+
+/**
+ * Pertinence Mapping Service setup.
+ * Loads the workspace geometry and advertises the service. The target
+ * pertinence exponent is served by dynamic_reconfigure under pn.
+ */
+void setup(ros::NodeHandle& n, ros::NodeHandle& pn)
+{
+	ws = miro_teleop::Workspace::load(n);
+	config_server = new dynamic_reconfigure::Server
+		<miro_teleop::PertinenceMappingConfig>(pn);
+	config_server->setCallback(reconfigure);
+	service = n.advertiseService("pertinence_mapper", PertinenceMapper);
+	ROS_INFO("Pertinence Mapping service active");
+}
+
+} // namespace pertinence_mapping
+
+#ifndef MIRO_TELEOP_COMPONENT
 /**
  * Pertinence Mapping Service Main function.
- * Initializes and advertises the service.
+ * Initializes the node and serves its callbacks.
  */
 int main(int argc, char **argv)
 {
 	ros::init(argc, argv, "pertinence_mapping_server");
-	ros::NodeHandle n;
-	ros::ServiceServer service =
-		n.advertiseService("pertinence_mapper", PertinenceMapper);
-	ROS_INFO("Pertinence Mapping service active");
+	ros::NodeHandle n, pn("~");
+	pertinence_mapping::setup(n, pn);
 	ros::spin();
 
 	return 0;
 }
+#endif
@@ -1,18 +1,35 @@
 /* Libraries */
 #include "miro_teleop/Path.h"
+#include "miro_teleop/Field.h"
+#include "miro_teleop/navigation.h"
 #include "ros/ros.h"
+#include "miro_teleop/components.h"
+#include "miro_teleop/ControllerConfig.h"
+#include <dynamic_reconfigure/server.h>
+#include "ros/callback_queue.h"
 #include "std_msgs/Bool.h"
+#include "std_msgs/Time.h"
 #include "miro_msgs/platform_control.h"
 #include "geometry_msgs/Pose2D.h"
 #include "geometry_msgs/Twist.h"
 #include <vector>
 #include <cmath>
+#include <mutex>
+
+namespace robot_controller {
 
 /* Global variables */
 bool enable = false;  // Controller status flag
 std::vector<geometry_msgs::Vector3> path; // Trajectory array
+bool navigating = false; // Descending a field instead of following a path
+miro_teleop::Workspace field_ws; // Grid of the field
+miro_teleop::Grid<double> field; // Cost to the goal of each cell
+rrtstar_msgs::Region field_goal; // Goal region of the field
 geometry_msgs::Pose2D robot; // Robot position
 geometry_msgs::Pose2D gesture; // Gesture position
+ros::Publisher ctl_pub; // Velocity commands to miro
+std::mutex ctl_mutex; // Serializes control ticks and stop handling
+miro_teleop::ControllerConfig gains; // Gains, see cfg/Controller.cfg
 
 /** 
  * Subscriber callback function.
@@ -26,17 +43,65 @@ void getPoint(const miro_teleop::Path::ConstPtr& points)
 	ROS_INFO("Received new path");
 	for(int i=0;i< points->path.size();i++)
 		path.push_back(points->path[i]);
+	navigating = false;
 }
 
 /** 
  * Subscriber callback function.
+ * Obtains the cost-to-goal field from Command Logic node, which replaces
+ * the path until a new path is received.
+ */
+void getField(const miro_teleop::Field::ConstPtr& msg)
+{
+	if(msg->cols<2 || msg->rows<2 || msg->cost.size()!=msg->cols*msg->rows)
+	{
+		ROS_ERROR("Invalid field of %dx%d cells", msg->cols, msg->rows);
+		return;
+	}
+	field_ws = miro_teleop::Workspace(msg->width, msg->height,
+					  msg->cols, msg->rows);
+	miro_teleop::fromMsg(msg->cost, msg->cols, msg->rows, field);
+	field_goal = msg->goal;
+	path.clear();
+	navigating = true;
+	ROS_INFO("Received new field");
+}
+
+/** 
+ * Subscriber callback function (high-priority queue).
  * Obtains enable/disable flag from Command Logic node. 
+ *
+ * Served with the stop, so that disabling halts the robot at once.
  */
 void getStatus(const std_msgs::Bool::ConstPtr& status)
 {
+	std::lock_guard<std::mutex> lock(ctl_mutex);
 	enable = status->data;
 	if(enable) ROS_INFO("Controller enabled");
-	else ROS_INFO("Controller disabled");
+	else
+	{
+		miro_msgs::platform_control cmd_stop; // Null velocity
+		ctl_pub.publish(cmd_stop);
+		ROS_INFO("Controller disabled");
+	}
+}
+
+/** 
+ * Subscriber callback function (high-priority queue).
+ * Obtains the stop command directly from the Interpreter node.
+ *
+ * Runs on its own spinner thread, so the robot is halted at once instead of
+ * at the next control tick. The latency is measured from the input time
+ * stamped by the interpreter.
+ */
+void getStop(const std_msgs::Time::ConstPtr& stamp)
+{
+	miro_msgs::platform_control cmd_stop; // Null velocity
+	std::lock_guard<std::mutex> lock(ctl_mutex);
+	enable = false;
+	ctl_pub.publish(cmd_stop);
+	ROS_INFO("Stop received: latency %.1f ms",
+	(ros::Time::now()-stamp->data).toSec()*1000);
 }
 
 /** 
@@ -60,8 +125,20 @@ void getCommanderPose(const geometry_msgs::Pose2D::ConstPtr& pose)
 	gesture.y = 100*pose->y;
 }
 
+/** 
+ * Reconfiguration callback function.
+ * Takes the new gains, used from the next control tick on.
+ */
+void reconfigure(miro_teleop::ControllerConfig& config, uint32_t level)
+{
+	std::lock_guard<std::mutex> lock(ctl_mutex);
+	gains = config;
+	ROS_INFO("Reconfigured: k_theta %.2f, linear gain %.1f, tolerance %.1f",
+		gains.k_theta, gains.linear_gain, gains.tolerance);
+}
+
 /**
- * Robot Controller Node main function.
+ * Robot Controller Node loop.
  * Performs robot position and orientation control.
  *
  * Given a reference from the trajectory received from the Command Logic,
@@ -69,40 +146,64 @@ void getCommanderPose(const geometry_msgs::Pose2D::ConstPtr& pose)
  * current distance and orientation error. This only happens if the flag
  * enable is set to 'true'. Otherwise, the command velocities are set to 0.
  *
- * When the reference position is reached (i.e. the distance is less than tol),
+ * When the reference position is reached (i.e. the distance is less than the tolerance),
  * the new desired position is taken from from the trajectory array. 
  *
  * If the path is empty, the goal position is considered reached and the enable
  * flag is set to 'false'.
+ *
+ * If a cost-to-goal field was received instead of a path, the reference
+ * heading is down its gradient at the robot position, at every tick, so the
+ * robot goes on without stopping until it enters the goal region.
+ *
+ * The callbacks of the node are served on a queue of its own, at each tick,
+ * so that the loop can share a process with other nodes.
+ *
+ * The gains (k_theta, linear_gain) and the tolerance are served by
+ * dynamic_reconfigure under pn.
  */
-int main(int argc, char **argv)
+int run(ros::NodeHandle& n, ros::NodeHandle& pn)
 {
 	/* Definitions */
 	geometry_msgs::Vector3 ref; // Reference position (from trajectory)
 	geometry_msgs::Pose2D commPos; // Commander position
 	double dr, dtheta; // Linear and angular displacements
-	double ktheta = 1; // Angular control gain
 	double vr, vtheta; // Desired linear and angular velocities
 	miro_msgs::platform_control cmd_vel; // Message to be published
-	double tol = 20.0;  // Displacement tolerance (in cm)
-	bool turn_blink;
+	bool turn_blink = false;
+	ros::CallbackQueue queue; // Served by the control loop
+	ros::CallbackQueue stop_queue; // Served apart from the control loop
 
-	/* Initialize and assign node handler */
-	ros::init(argc, argv, "robot_controller");
-	ros::NodeHandle n;
+	n.setCallbackQueue(&queue);
+	pn.setCallbackQueue(&queue);
+
+	/* Gains from the parameters (or the defaults), then live */
+	dynamic_reconfigure::Server<miro_teleop::ControllerConfig> config_server(pn);
+	config_server.setCallback(reconfigure);
 
 	/* Initialize publishers and subscribers */
-	ros::Publisher  ctl_pub =
+	ctl_pub =
 	n.advertise<miro_msgs::platform_control>
 	("/miro/rob01/platform/control", 10);
 	ros::Subscriber path_sub =
 	n.subscribe("path", 1, getPoint);
-	ros::Subscriber en_sub =
-	n.subscribe("enable", 1, getStatus);
+	ros::Subscriber field_sub =
+	n.subscribe("field", 1, getField);
 	ros::Subscriber mocap_sub =
 	n.subscribe("Robot/ground_pose", 10, getRobotPose);
 	ros::Subscriber gest_sub = 
 	n.subscribe("Gesture/ground_pose", 10, getCommanderPose);
+	// Stop and enable bypass the loop period on a dedicated spinner
+	ros::SubscribeOptions stop_ops =
+	ros::SubscribeOptions::create<std_msgs::Time>
+	("stop", 1, getStop, ros::VoidPtr(), &stop_queue);
+	ros::Subscriber stop_sub = n.subscribe(stop_ops);
+	ros::SubscribeOptions en_ops =
+	ros::SubscribeOptions::create<std_msgs::Bool>
+	("enable", 1, getStatus, ros::VoidPtr(), &stop_queue);
+	ros::Subscriber en_sub = n.subscribe(en_ops);
+	ros::AsyncSpinner stop_spinner(1, &stop_queue);
+	stop_spinner.start();
 
 	/* Update rate (period) */
 	ros::Rate loop_rate(10);
@@ -112,9 +213,46 @@ int main(int argc, char **argv)
 	/* Main loop */
 	while (ros::ok())
 	{
+		/* A stop arriving meanwhile waits for the end of this tick */
+		{
+		std::lock_guard<std::mutex> lock(ctl_mutex);
 
+		/* Navigation: descend the field until in the goal region */
+		if(enable && navigating)
+		{
+			double gx, gy;
+			if(fabs(robot.x-field_goal.center_x)<=field_goal.size_x/2 &&
+			   fabs(robot.y-field_goal.center_y)<=field_goal.size_y/2)
+			{
+				enable = false;
+				navigating = false;
+				ROS_INFO("Goal region reached");
+				ROS_INFO("Controller disabled");
+				turn_blink = true;
+			}
+			else if(!miro_teleop::fieldGradient(field_ws, field,
+					robot.x, robot.y, gx, gy) ||
+				(gx==0 && gy==0))
+			{
+				enable = false;
+				ROS_INFO("No descent from the robot position");
+				ROS_INFO("Controller disabled");
+			}
+			else
+			{
+				dtheta = atan2(-gy,-gx)-robot.theta;
+				dtheta = atan2(sin(dtheta),cos(dtheta));
+				vr = gains.linear_gain*cos(dtheta);
+				vtheta = gains.k_theta*dtheta;
+				cmd_vel.body_vel.linear.x = vr;
+				cmd_vel.body_vel.angular.z = vtheta;
+				ctl_pub.publish(cmd_vel);
+				ROS_INFO("Descent heading %f, speed linear %f, "
+				"angular %f", atan2(-gy,-gx), vr, vtheta);
+			}
+		}
 		/* Perform control only with flag enabled */
-		if(enable)
+		else if(enable)
 		{
 			ref = path.front();
 			/* Compute displacements */
@@ -123,7 +261,7 @@ int main(int argc, char **argv)
 			dtheta = atan2(sin(dtheta),cos(dtheta));
 
 			/* Verify if the robot is close enough to target */
-			if(dr<=tol)
+			if(dr<=gains.tolerance)
 			{
 				/* Obtain new reference position */
 				if(!path.empty())
@@ -146,8 +284,8 @@ int main(int argc, char **argv)
 			{
 
 				/* Obtain reference speeds (linear/angular) */
-				vr = 200*cos(dtheta); // Max speed: 400 cm/s
-				vtheta = ktheta*dtheta; // P angular control
+				vr = gains.linear_gain*cos(dtheta); // Max speed: 400 cm/s
+				vtheta = gains.k_theta*dtheta; // P angular control
 
 				/* Compose message and publish */
 				cmd_vel.body_vel.linear.x = vr;
@@ -185,11 +323,27 @@ int main(int argc, char **argv)
 			ctl_pub.publish(cmd_vel);
 			}
 		}
+		}
 
 		/* Spin and wait for next period */
-		ros::spinOnce();
+		queue.callAvailable();
 		loop_rate.sleep();
 	}
 
 	return 0;
 }
+
+} // namespace robot_controller
+
+#ifndef MIRO_TELEOP_COMPONENT
+/**
+ * Robot Controller Node main function.
+ * Initializes the node and runs the control loop until shutdown.
+ */
+int main(int argc, char **argv)
+{
+	ros::init(argc, argv, "robot_controller");
+	ros::NodeHandle n, pn("~");
+	return robot_controller::run(n, pn);
+}
+#endif
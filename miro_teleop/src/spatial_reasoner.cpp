@@ -1,15 +1,58 @@
 /* Libraries */
 #include "ros/ros.h"
+#include "miro_teleop/components.h"
+#include "miro_teleop/landscape.h"
+#include "ros/topic.h"
+#include "geometry_msgs/Pose2D.h"
 #include "miro_teleop/SpatialReasoner.h"
 #include <cstdio>
 #include <cmath>
+#include <vector>
+
+namespace spatial_reasoner {
 
 /* Definitions */
-#define PI 3.14159
-#define NZ 5 // Number of relations (north, south, west, east, distance-to)
-#define HSIZE 400 // Horizontal map size (in cm)
-#define VSIZE 400 // Vertical map size (in cm)
-#define RES 40 // Grid resolution
+#define CACHE_TOL 1.0 // Obstacle displacement (cm) under which landscapes are reused
+
+/* Workspace discretization (loaded at startup) */
+miro_teleop::Workspace ws;
+
+/* Margin (cm) around the obstacle where the landscapes are null */
+double margin;
+
+/* Landscapes of the last obstacle, served again for identical requests */
+miro_teleop::SpatialReasoner::Response cached;
+double cached_obstacle[4]; // Center x, y and dimensions a, b
+
+/**
+ * Generates the spatial relation landscapes of one obstacle.
+ *
+ * The direction landscapes premultiplied by the distance-to one, and the
+ * maxima of both, are sent along, so that the mapper does not redo the
+ * products for each target. The landscapes are cleared up to the margin
+ * around the obstacle.
+ *
+ * @param xr Obstacle center x
+ * @param yr Obstacle center y
+ * @param a Obstacle width
+ * @param b Obstacle height
+ * @param res Output, NZ matrices of RESxRES (mapped in an 1-D array), the
+ * premultiplied ones and the maxima
+ */
+void computeLandscapes(double xr, double yr, double a, double b,
+		       miro_teleop::SpatialReasoner::Response& res)
+{
+	miro_teleop::Grid<double> landscapes, premultiplied;
+	double maxima[2*(NZ-1)];
+
+	miro_teleop::spatialLandscapes(ws, xr, yr, a, b, landscapes);
+	miro_teleop::clearMargin(ws, xr, yr, a, b, margin, landscapes);
+	miro_teleop::premultiply(landscapes, premultiplied, maxima);
+	miro_teleop::toMsg(landscapes, res.matrices);
+	miro_teleop::toMsg(premultiplied, res.premultiplied);
+	res.maxima.resize(2*(NZ-1));
+	for(int i=0;i<2*(NZ-1);i++) res.maxima[i].data = maxima[i];
+}
 
 /**
  * Spatial Reasoner Service function.
@@ -23,13 +66,13 @@
  *
  * The "distance-to" relation returns the pertinence with respect to a desired
  * distance range from the object, which can be modified.
+ *
+ * The landscapes of the last obstacle are kept, and returned directly when
+ * the same obstacle (up to mocap noise) is requested again.
  */
 bool SpatialReasoner(miro_teleop::SpatialReasoner::Request  &req,
          	     miro_teleop::SpatialReasoner::Response &res)
 {
-	/* Matrices to be sent back to master (mapped in an 1-D array) */
-	std_msgs::Float64 M[NZ*RES*RES];
-
 	/* Obstacle center obtained from motion capture */
 	double xr = req.center.x;
 	double yr = req.center.y;
@@ -37,82 +80,37 @@ bool SpatialReasoner(miro_teleop::SpatialReasoner::Request  &req,
 	double a = req.dimensions[0].data;
 	double b = req.dimensions[1].data;
 
-	/* Other definitions */
-	double xp, yp, xq, yq, xv, yv;
-	double angle, beta_min, beta, dist_min, dist;
-        double c_ang, s_ang; // Store cosines and sines to increase performance
-
 	ROS_INFO("Request received from master node");
 
-	/* For every element P=(x,y) of the grid, compute the pertinences */
-	for(int x=0;x<RES;x++)
+	/* Same obstacle as the last (or prewarmed) one: nothing to compute */
+	if(!cached.matrices.empty() && fabs(xr-cached_obstacle[0])<CACHE_TOL
+			   && fabs(yr-cached_obstacle[1])<CACHE_TOL
+			   && a==cached_obstacle[2] && b==cached_obstacle[3])
 	{
-           for(int y=0;y<RES;y++)
-	   {
-		/* Map indices to actual location on the map */
-		xp = HSIZE/double(2*RES)+HSIZE*(x/double(RES))-HSIZE/2;
-		yp = VSIZE/double(2*RES)+VSIZE*(y/double(RES))-VSIZE/2;
-		/* If P is inside the obstacle, pertinences are null */
-		if((xp>(xr-a/2))&&(xp<(xr+a/2))
-					&&(yp>(yr-b/2))&&(yp<(yr+b/2)))
-                {
-                               for(int dir=0; dir<NZ; dir++) 
-				M[x+y*RES+dir*RES*RES].data=0;
-                }
-		/* Otherwise, compute with respect to each direction */
-		else
-		{
-                       	for(int dir=0; dir<NZ-1; dir++)
-                       	{
-                               	angle = dir*PI/2; // Direction angle
-                               	c_ang = cos(angle);
-                               	s_ang = sin(angle);
-                               	beta_min = PI/2; // Initial value of beta
-                               	dist_min = 1000; // Initial value of distance
-                               
-				/* For every element of the object calculate */
-				for(int i=0;i<RES;i++)
-                               	{
-                                       	for(int j=0;j<RES;j++)
-                                       	{
-						// Compute beta and dist
-                                               	xq = xr-a/2+a*(i/double(RES));
-                                               	yq = yr-b/2+b*(j/double(RES));
-                                               	xv = xp-xq;
-                                               	yv = yp-yq;
-                                               	dist = sqrt(xv*xv+yv*yv);
-                                               	if(dist==0) beta=0;
-                                               	else beta = 
-						acos((xv*c_ang+yv*s_ang)/dist);
-                                               	// Find minimum values
-						if(beta<beta_min) 
-						beta_min = beta;
-                                               	if(dist<dist_min) 
-						dist_min = dist;
-                                       	}
-                               	}
-				/* Update matrices with minimum pertinences */
-                               	M[x+y*RES+dir*RES*RES].data
-					= fmax(0,1.0-(2.0*beta_min/PI));
-				/* Update the minimum distance of P to object */
-                               	M[x+y*RES+4*RES*RES].data 
-				= fmin(1,fmax(0,dist_min*exp(-dist_min/60)/20));
-                       	}
-		}
-	   }
+		res = cached;
+		ROS_INFO("Landscapes served from cache");
+		return true;
 	}
 
+	computeLandscapes(xr, yr, a, b, cached);
+	cached_obstacle[0] = xr;
+	cached_obstacle[1] = yr;
+	cached_obstacle[2] = a;
+	cached_obstacle[3] = b;
+	const std::vector<std_msgs::Float64>& M = cached.matrices;
+
 	/* Assign matrices to response structure */
-	for (int i=0;i<NZ*RES*RES;i++) res.matrices.push_back(M[i]);
+	res = cached;
 
 	/* Optional: Print matrices */
 	for (int dir=0;dir<NZ;dir++) 
 	{
 		ROS_INFO("Printing Matrix %d:",dir+1);
-		for (int i=0;i<RES;i++)
+		for (int i=0;i<ws.cols;i++)
 		{
-			for (int j=0;j<RES;j++)
-				printf("%3.2f ", M[i+j*RES+dir*RES*RES].data);
+			for (int j=0;j<ws.rows;j++)
+				printf("%3.2f ", M[i+j*ws.cols+
+						   dir*ws.cols*ws.rows].data);
 			printf("\n");
 		}		
 		printf("\n\n");
@@ -123,19 +121,71 @@ bool SpatialReasoner(miro_teleop::SpatialReasoner::Request  &req,
   	return true;
 }
 
+/* Service handle, kept for the lifetime of the node */
+ros::ServiceServer service;
+
+/**
+ * Spatial Reasoner Service setup.
+ * Loads the workspace geometry, prewarms the landscapes and advertises the
+ * service.
+ *
+ * The obstacle dimensions expected for the prewarm are obstacle/width and
+ * obstacle/height, as for the master, unless ~obstacle_width and
+ * ~obstacle_height are set. The landscapes are null within ~margin (cm) of
+ * the obstacle, inside it only by default.
+ */
+void setup(ros::NodeHandle& n, ros::NodeHandle& pn)
+{
+	double a, b, timeout; // Expected obstacle dimensions, pose timeout
+
+	ws = miro_teleop::Workspace::load(n);
+	n.param("obstacle/width", a, 80.0);
+	n.param("obstacle/height", b, 80.0);
+	pn.param("obstacle_width", a, a);
+	pn.param("obstacle_height", b, b);
+	pn.param("prewarm_timeout", timeout, 5.0);
+	pn.param("margin", margin, 0.0);
+
+	/* Prewarm: landscapes of the current obstacle, before advertising */
+	geometry_msgs::Pose2D::ConstPtr pose =
+		ros::topic::waitForMessage<geometry_msgs::Pose2D>
+		("Obstacle/ground_pose", n, ros::Duration(timeout));
+	if(pose)
+	{
+		ros::WallTime start = ros::WallTime::now();
+		// Same units as the master (cm)
+		cached_obstacle[0] = 100*pose->x;
+		cached_obstacle[1] = 100*pose->y;
+		cached_obstacle[2] = a;
+		cached_obstacle[3] = b;
+		computeLandscapes(cached_obstacle[0], cached_obstacle[1], a, b,
+				  cached);
+		ROS_INFO("Landscapes prewarmed in %.3f s",
+			(ros::WallTime::now()-start).toSec());
+	}
+	else
+		ROS_INFO("No obstacle pose: landscapes computed on request");
+
+	/* Advertising the service signals that the server is ready */
+	service = n.advertiseService("spatial_reasoner", SpatialReasoner);
+	ROS_INFO("Spatial Reasoning service active: %gx%g cm, %dx%d cells",
+		ws.width, ws.height, ws.cols, ws.rows);
+}
+
+} // namespace spatial_reasoner
+
+#ifndef MIRO_TELEOP_COMPONENT
 /**
  * Spatial Reasoner Service Main function.
- * Initializes and advertises the service.
+ * Initializes the node and serves its callbacks.
  */
 int main(int argc, char **argv)
 {
 	ros::init(argc, argv, "spatial_reasoning_server");
-	ros::NodeHandle n;
-	ros::ServiceServer service =
-		n.advertiseService("spatial_reasoner", SpatialReasoner);
-	ROS_INFO("Spatial Reasoning service active");
+	ros::NodeHandle n, pn("~");
+	spatial_reasoner::setup(n, pn);
 	ros::spin();
 
 	return 0;
 }
-
+#endif
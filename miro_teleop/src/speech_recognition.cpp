@@ -0,0 +1,503 @@
+/* Libraries */
+#include "ros/ros.h"
+#include "miro_teleop/Command.h"
+#include "std_msgs/Time.h"
+#include <cstdio>
+#include <cmath>
+#include <cfloat>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* Definitions */
+#define RATE 16000 // Sampling rate of the input audio (Hz, 16-bit mono PCM)
+#define FRAME 400 // Analysis window (25 ms)
+#define HOP 160 // Frame period (10 ms)
+#define NFFT 512 // FFT size
+#define NMEL 24 // Number of mel filters
+#define NCEP 12 // Number of cepstral coefficients (c0 is dropped)
+#define FMIN 100.0 // Lowest filter frequency (Hz)
+#define FMAX 7600.0 // Highest filter frequency (Hz)
+#define VAD_DB 12.0 // Speech detection threshold above the noise floor (dB)
+#define ONSET 3 // Speech frames needed to start an utterance
+#define HANGOVER 12 // Silence frames that end an utterance (120 ms)
+#define MIN_FRAMES 15 // Shortest utterance accepted (150 ms)
+#define MAX_FRAMES 150 // Longest utterance, ended anyway (1.5 s)
+
+/* Keyword table: words, the tags sent to the master and their priorities */
+struct Keyword
+{
+	const char* word;
+	unsigned char tag;
+	unsigned char priority;
+};
+
+const Keyword keywords[] =
+{
+	{"look", miro_teleop::Command::LOOK, miro_teleop::Command::PRIORITY_LOOK},
+	{"go",   miro_teleop::Command::GO,   miro_teleop::Command::PRIORITY_GO},
+	{"stop", miro_teleop::Command::STOP, miro_teleop::Command::PRIORITY_STOP}
+};
+
+const int NKEYWORDS = sizeof(keywords)/sizeof(keywords[0]);
+
+/* Template: cepstra of one enrolled utterance of a keyword */
+struct Template
+{
+	int keyword; // Index in the keyword table
+	int frames;
+	std::vector<double> cep; // frames x NCEP
+};
+
+/* Global variables */
+std::vector<Template> templates; // Enrolled keyword utterances
+double window[FRAME]; // Hamming window
+double cosines[NFFT/2], sines[NFFT/2]; // FFT twiddle factors
+std::vector<double> filters[NMEL]; // Mel filter weights, per FFT bin
+int firstBin[NMEL]; // First FFT bin of each filter
+double dct[NCEP][NMEL]; // DCT-II matrix (without c0)
+ros::Publisher cmd_pub; // Commands to the master
+ros::Publisher stop_pub; // High-priority (latched) stop
+
+/**
+ * Precomputes the window, FFT twiddles, mel filterbank and DCT matrix,
+ * so that the per-frame work is only arithmetic.
+ */
+void initFeatures()
+{
+	for (int i=0;i<FRAME;i++)
+		window[i] = 0.54-0.46*cos(2*M_PI*i/(FRAME-1));
+	for (int i=0;i<NFFT/2;i++)
+	{
+		cosines[i] = cos(2*M_PI*i/NFFT);
+		sines[i] = -sin(2*M_PI*i/NFFT);
+	}
+
+	/* Triangular filters equally spaced on the mel scale */
+	double mmin = 2595*log10(1+FMIN/700), mmax = 2595*log10(1+FMAX/700);
+	double edges[NMEL+2];
+	for (int m=0;m<NMEL+2;m++)
+	{
+		double mel = mmin+(mmax-mmin)*m/(NMEL+1);
+		edges[m] = (700*(pow(10,mel/2595)-1))*NFFT/RATE; // In bins
+	}
+	for (int m=0;m<NMEL;m++)
+	{
+		firstBin[m] = ceil(edges[m]);
+		filters[m].clear();
+		for (int k=firstBin[m];k<=edges[m+2];k++)
+		{
+			if (k<=edges[m+1])
+				filters[m].push_back((k-edges[m])/(edges[m+1]-edges[m]));
+			else
+				filters[m].push_back((edges[m+2]-k)/(edges[m+2]-edges[m+1]));
+		}
+	}
+
+	for (int c=0;c<NCEP;c++)
+		for (int m=0;m<NMEL;m++)
+			dct[c][m] = cos(M_PI*(c+1)*(m+0.5)/NMEL);
+}
+
+/**
+ * In-place iterative radix-2 FFT of NFFT points.
+ *
+ * @param re Real parts
+ * @param im Imaginary parts
+ */
+void fft(double* re, double* im)
+{
+	/* Bit-reversal permutation */
+	for (int i=1,j=0;i<NFFT;i++)
+	{
+		int bit = NFFT>>1;
+		for (;j&bit;bit>>=1) j ^= bit;
+		j ^= bit;
+		if (i<j)
+		{
+			std::swap(re[i],re[j]);
+			std::swap(im[i],im[j]);
+		}
+	}
+	/* Butterflies */
+	for (int len=2;len<=NFFT;len<<=1)
+	{
+		int step = NFFT/len;
+		for (int i=0;i<NFFT;i+=len)
+		{
+			for (int k=0;k<len/2;k++)
+			{
+				double wr = cosines[k*step], wi = sines[k*step];
+				int a = i+k, b = i+k+len/2;
+				double xr = re[b]*wr-im[b]*wi;
+				double xi = re[b]*wi+im[b]*wr;
+				re[b] = re[a]-xr; im[b] = im[a]-xi;
+				re[a] += xr; im[a] += xi;
+			}
+		}
+	}
+}
+
+/**
+ * Computes the cepstrum of one frame and returns its energy.
+ *
+ * @param samples FRAME samples
+ * @param cep Output, NCEP mel-frequency cepstral coefficients
+ * @return Frame energy (dB)
+ */
+double frameFeatures(const double* samples, double* cep)
+{
+	double re[NFFT], im[NFFT], power[NFFT/2+1], logmel[NMEL];
+	double energy = 0;
+
+	for (int i=0;i<NFFT;i++)
+	{
+		re[i] = i<FRAME ? samples[i]*window[i] : 0;
+		im[i] = 0;
+		if (i<FRAME) energy += samples[i]*samples[i];
+	}
+	fft(re, im);
+	for (int k=0;k<=NFFT/2;k++) power[k] = re[k]*re[k]+im[k]*im[k];
+
+	for (int m=0;m<NMEL;m++)
+	{
+		double sum = 0;
+		for (int k=0;k<filters[m].size();k++)
+			sum += filters[m][k]*power[firstBin[m]+k];
+		logmel[m] = log(sum+1e-10);
+	}
+	for (int c=0;c<NCEP;c++)
+	{
+		cep[c] = 0;
+		for (int m=0;m<NMEL;m++) cep[c] += dct[c][m]*logmel[m];
+	}
+
+	return 10*log10(energy/FRAME+1e-10);
+}
+
+/**
+ * Removes the mean of each coefficient over an utterance, which cancels
+ * the channel (microphone, room) response.
+ */
+void normalize(std::vector<double>& cep, int frames)
+{
+	for (int c=0;c<NCEP;c++)
+	{
+		double mean = 0;
+		for (int f=0;f<frames;f++) mean += cep[f*NCEP+c];
+		mean /= frames;
+		for (int f=0;f<frames;f++) cep[f*NCEP+c] -= mean;
+	}
+}
+
+/**
+ * Dynamic time warping distance between two utterances, normalized by
+ * the length of both.
+ */
+double dtw(const std::vector<double>& a, int n, const std::vector<double>& b,
+	   int m)
+{
+	std::vector<double> prev(m+1, DBL_MAX), cur(m+1);
+	prev[0] = 0;
+	for (int i=1;i<=n;i++)
+	{
+		cur[0] = DBL_MAX;
+		for (int j=1;j<=m;j++)
+		{
+			double d = 0;
+			for (int c=0;c<NCEP;c++)
+			{
+				double diff = a[(i-1)*NCEP+c]-b[(j-1)*NCEP+c];
+				d += diff*diff;
+			}
+			d = sqrt(d);
+			double best = fmin(prev[j-1], fmin(prev[j], cur[j-1]));
+			cur[j] = best+d;
+		}
+		prev.swap(cur);
+	}
+	return prev[m]/(n+m);
+}
+
+/**
+ * Matches an utterance against all templates.
+ *
+ * @param cep Utterance cepstra (normalized)
+ * @param frames Utterance length
+ * @param distance Output, distance to the closest template
+ * @return Index of the keyword of the closest template, -1 if none
+ */
+int recognize(const std::vector<double>& cep, int frames, double& distance)
+{
+	int best = -1;
+	distance = DBL_MAX;
+	for (int t=0;t<templates.size();t++)
+	{
+		// Words more than twice as long or short cannot match
+		if (frames > 2*templates[t].frames || 2*frames < templates[t].frames)
+			continue;
+		double d = dtw(cep, frames, templates[t].cep, templates[t].frames);
+		if (d < distance)
+		{
+			distance = d;
+			best = templates[t].keyword;
+		}
+	}
+	return best;
+}
+
+/**
+ * Loads the keyword templates from a directory of raw recordings.
+ *
+ * Each file <word>.raw or <word>_<n>.raw holds one utterance of the keyword
+ * (16 kHz 16-bit mono PCM). Leading and trailing silence is trimmed.
+ *
+ * @return Number of templates loaded
+ */
+int loadTemplates(const std::string& dir)
+{
+	DIR* d = opendir(dir.c_str());
+	if (d == NULL) return 0;
+
+	struct dirent* entry;
+	while ((entry = readdir(d)) != NULL)
+	{
+		std::string name = entry->d_name;
+		if (name.size() < 4 ||
+		    name.compare(name.size()-4, 4, ".raw") != 0) continue;
+		const size_t end = name.size()-4; // Before ".raw"
+		int k;
+		for (k=0;k<NKEYWORDS;k++)
+		{
+			std::string word = keywords[k].word;
+			if (name.compare(0, word.size(), word) != 0) continue;
+			if (end == word.size()) break;
+			if (end > word.size()+1 && name[word.size()] == '_' &&
+			    name.find_first_not_of("0123456789", word.size()+1)
+			    == end)
+				break;
+		}
+		if (k == NKEYWORDS) continue;
+
+		FILE* f = fopen((dir+"/"+name).c_str(), "rb");
+		if (f == NULL) continue;
+		std::vector<double> samples;
+		short s;
+		while (fread(&s, sizeof(s), 1, f) == 1) samples.push_back(s);
+		fclose(f);
+
+		/* Cepstra and energies of all frames */
+		std::vector<double> cep, energy;
+		double c[NCEP];
+		for (int i=0;i+FRAME<=samples.size();i+=HOP)
+		{
+			energy.push_back(frameFeatures(&samples[i], c));
+			cep.insert(cep.end(), c, c+NCEP);
+		}
+		if (energy.empty()) continue;
+
+		/* Trim frames more than 30 dB below the loudest one */
+		double peak = -DBL_MAX;
+		for (int i=0;i<energy.size();i++) peak = fmax(peak, energy[i]);
+		int first = 0, last = energy.size()-1;
+		while (energy[first] < peak-30) first++;
+		while (energy[last] < peak-30) last--;
+
+		Template t;
+		t.keyword = k;
+		t.frames = last-first+1;
+		t.cep.assign(cep.begin()+first*NCEP, cep.begin()+(last+1)*NCEP);
+		normalize(t.cep, t.frames);
+		templates.push_back(t);
+		ROS_INFO("Template %s: %d frames", name.c_str(), t.frames);
+	}
+	closedir(d);
+
+	return templates.size();
+}
+
+/**
+ * Speech Recognition Node main function.
+ * Spots command keywords in a 16 kHz audio stream and sends them.
+ *
+ * Audio (16-bit mono PCM) is read from standard input, or from the file
+ * or pipe given by the ~input parameter, in frames of 10 ms. An energy
+ * detector tracking the noise floor cuts the stream into utterances, which
+ * end after HANGOVER silent frames. Each utterance is described by its
+ * mel-frequency cepstra and compared by dynamic time warping with the
+ * keyword templates recorded in the ~templates directory. The closest
+ * keyword is sent to the Command Logic Node, with its priority, if its
+ * distance is below ~threshold; a stop is also sent on the high-priority
+ * "stop" topic, as the Interpreter does. Commands are not resent, since a
+ * late command is worse than a missed one when speaking.
+ *
+ * Everything runs on the CPU with no external service. The latency of a
+ * command is the hangover plus the matching time, both logged for each
+ * utterance. When a regular file is given, it is processed as fast as it
+ * is read and a summary is printed at its end, so that recorded audio can
+ * be used as an offline benchmark (and to calibrate the threshold).
+ */
+int main(int argc, char **argv)
+{
+	/* Definitions */
+	std::string input, dir; // Audio source and template directory
+	double threshold; // Largest accepted template distance
+	FILE* audio;
+	bool pipe = true;
+
+	/* Initialize and assign node handler */
+	ros::init(argc, argv, "speech_recognition");
+	ros::NodeHandle n;
+	ros::NodeHandle("~").param("input", input, std::string(""));
+	ros::NodeHandle("~").param("templates", dir, std::string("templates"));
+	ros::NodeHandle("~").param("threshold", threshold, 8.0);
+
+	/* Initialize publishers */
+	cmd_pub = n.advertise<miro_teleop::Command>("command", 10);
+	stop_pub = n.advertise<std_msgs::Time>("stop", 1, true);
+
+	initFeatures();
+	if (loadTemplates(dir) == 0)
+	{
+		ROS_ERROR("No keyword templates found in %s", dir.c_str());
+		return 1;
+	}
+
+	if (input.empty()) audio = stdin;
+	else
+	{
+		struct stat info;
+		if (stat(input.c_str(), &info) == 0) pipe = S_ISFIFO(info.st_mode);
+		audio = fopen(input.c_str(), "rb");
+		if (audio == NULL)
+		{
+			ROS_ERROR("Cannot open audio input %s", input.c_str());
+			return 1;
+		}
+	}
+
+	ROS_INFO("Speech Recognition node active");
+
+	/* Stream state */
+	double samples[FRAME] = {0}, c[NCEP];
+	short hop[HOP];
+	long frame = 0; // Frames read so far
+	double noise = 0; // Noise floor (dB)
+	int onset = 0, silence = 0;
+	bool speech = false;
+	std::vector<double> cep; // Cepstra of the current utterance
+	long start = 0; // First frame of the current utterance
+	unsigned int seq = 0; // Sequence number of the last command sent
+
+	/* Benchmark counters */
+	int utterances = 0, detections[NKEYWORDS] = {0};
+	double matchTime = 0, maxMatchTime = 0;
+	ros::WallTime begin = ros::WallTime::now();
+
+	while (ros::ok())
+	{
+		if (fread(hop, sizeof(short), HOP, audio) != HOP)
+		{
+			// Pipe: wait for the next writer; file: benchmark ends
+			if (pipe && !input.empty())
+			{
+				fclose(audio);
+				audio = fopen(input.c_str(), "rb");
+				if (audio != NULL) continue;
+			}
+			break;
+		}
+
+		/* Slide the analysis window by one hop */
+		for (int i=0;i<FRAME-HOP;i++) samples[i] = samples[i+HOP];
+		for (int i=0;i<HOP;i++) samples[FRAME-HOP+i] = hop[i];
+		double energy = frameFeatures(samples, c);
+		bool loud = energy > noise+VAD_DB;
+
+		if (frame++ < 10)
+		{
+			// Initial noise floor from the first 100 ms
+			noise = frame==1 ? energy : fmax(noise, energy);
+			continue;
+		}
+
+		if (!speech)
+		{
+			if (!loud)
+			{
+				noise = 0.95*noise+0.05*energy;
+				onset = 0;
+				cep.clear();
+				continue;
+			}
+			cep.insert(cep.end(), c, c+NCEP);
+			if (++onset < ONSET) continue;
+			speech = true;
+			silence = 0;
+			start = frame-ONSET;
+			continue;
+		}
+
+		cep.insert(cep.end(), c, c+NCEP);
+		silence = loud ? 0 : silence+1;
+		int frames = cep.size()/NCEP;
+		if (silence < HANGOVER && frames < MAX_FRAMES) continue;
+
+		/* End of utterance: drop the trailing silence and match */
+		speech = false;
+		onset = 0;
+		frames -= silence;
+		if (frames >= MIN_FRAMES)
+		{
+			ros::WallTime t0 = ros::WallTime::now();
+			cep.resize(frames*NCEP);
+			normalize(cep, frames);
+			double distance;
+			int k = recognize(cep, frames, distance);
+			double ms = (ros::WallTime::now()-t0).toSec()*1000;
+
+			if (k >= 0 && distance < threshold)
+			{
+				miro_teleop::Command msg;
+				msg.seq = ++seq;
+				msg.source = ros::this_node::getName();
+				msg.command = keywords[k].tag;
+				msg.priority = keywords[k].priority;
+				if (msg.command == msg.STOP)
+				{
+					std_msgs::Time stop;
+					stop.data = ros::Time::now();
+					stop_pub.publish(stop);
+				}
+				cmd_pub.publish(msg);
+				detections[k]++;
+			}
+
+			utterances++;
+			matchTime += ms;
+			maxMatchTime = fmax(maxMatchTime, ms);
+			ROS_INFO("Utterance at %.2f s (%d frames): %s, distance %.2f, "
+				"latency %.0f ms (%d ms hangover + %.1f ms matching)",
+				start*HOP/double(RATE), frames,
+				k>=0 && distance<threshold ? keywords[k].word : "rejected",
+				distance, silence*HOP*1000.0/RATE+ms,
+				silence*HOP*1000/RATE, ms);
+		}
+		cep.clear();
+	}
+
+	/* Offline benchmark summary */
+	double wall = (ros::WallTime::now()-begin).toSec();
+	double duration = frame*HOP/double(RATE);
+	ROS_INFO("Audio processed: %.1f s in %.2f s (real-time factor %.3f)",
+		duration, wall, duration>0 ? wall/duration : 0);
+	ROS_INFO("Utterances: %d, mean matching %.1f ms, max %.1f ms",
+		utterances, utterances ? matchTime/utterances : 0, maxMatchTime);
+	for (int k=0;k<NKEYWORDS;k++)
+		ROS_INFO("Detected %s: %d", keywords[k].word, detections[k]);
+
+	if (audio != NULL && audio != stdin) fclose(audio);
+
+	return 0;
+}
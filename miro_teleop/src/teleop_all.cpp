@@ -0,0 +1,112 @@
+/* Libraries */
+#include "ros/ros.h"
+#include "miro_teleop/components.h"
+#include "rrtstar/rrtstar_node.h"
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+#include <thread>
+
+/**
+ * Pins the calling thread to the CPUs listed in ~affinity/<name>.
+ * Nothing is done if the parameter is not set (the thread may run anywhere).
+ *
+ * @param pn Private handle of the process
+ * @param name Name of the thread (executor, command_logic, robot_controller)
+ */
+void pin(ros::NodeHandle& pn, const std::string& name)
+{
+	std::vector<int> cpus; // CPUs allowed to the thread
+	cpu_set_t set;
+
+	if(!pn.getParam("affinity/"+name, cpus) || cpus.empty()) return;
+
+	CPU_ZERO(&set);
+	for(int i=0;i<cpus.size();i++) CPU_SET(cpus[i], &set);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set)!=0)
+	{
+		ROS_ERROR("Cannot set the affinity of %s", name.c_str());
+		return;
+	}
+	ROS_INFO("Thread %s pinned to %d CPU(s)", name.c_str(), (int)cpus.size());
+}
+
+/**
+ * Control loop thread function.
+ * Pins itself and runs a loop node until shutdown.
+ */
+void runLoop(int (*run)(ros::NodeHandle&, ros::NodeHandle&),
+	     std::string name)
+{
+	ros::NodeHandle n, pn("~"), cpn("~"+name);
+
+	pin(pn, name);
+	if(run(n, cpn)!=0) ROS_ERROR("Component %s ended", name.c_str());
+}
+
+/**
+ * Teleoperation main function (single process).
+ * Runs all the teleoperation nodes, and the RRT* planner, in one process.
+ *
+ * Services and topics keep their names, and the nodes talk as they do when
+ * run apart: service calls still go over loopback TCPROS, and messages
+ * still get serialized. What this saves is the separate processes and
+ * their ROS nodes, with their threads, replaced by one node and a shared
+ * executor.
+ *
+ * The servers and the interpreter share one executor: ~threads spinner
+ * threads serving the global callback queue. The Command Logic and the
+ * Robot Controller keep their own loops, each on a thread of its own. The
+ * private parameters of each component are under ~<component> (e.g.
+ * ~command_logic/plot), and ~affinity/<thread> lists the CPUs each thread
+ * may run on, for the executor, command_logic and robot_controller threads.
+ *
+ * The speech recognition node reads audio from its standard input, so it
+ * is still run apart.
+ */
+int main(int argc, char **argv)
+{
+	/* Definitions */
+	int threads; // Executor threads
+
+	/* Initialize and assign node handlers */
+	ros::init(argc, argv, "teleop");
+	ros::NodeHandle n, pn("~");
+	pn.param("threads", threads, 2);
+
+	/* Spinner threads inherit the affinity of this one */
+	pin(pn, "executor");
+
+	/* Servers first, so that the master finds them ready */
+	ros::NodeHandle gest_pn("~gesture_processing");
+	gesture_processing::setup(n, gest_pn);
+	ros::NodeHandle pert_pn("~pertinence_mapping");
+	pertinence_mapping::setup(n, pert_pn);
+	ros::NodeHandle spat_pn("~spatial_reasoner");
+	spatial_reasoner::setup(n, spat_pn);
+	ros::NodeHandle mont_pn("~monte_carlo");
+	monte_carlo::setup(n, mont_pn);
+	ros::NodeHandle rrts_pn("~rrtstar");
+	rrtstar_node::setup(n, rrts_pn);
+
+	ros::AsyncSpinner executor(threads);
+	executor.start();
+
+	ros::NodeHandle inter_pn("~interpreter");
+	interpreter::setup(n, inter_pn);
+
+	/* Loop nodes, on their own threads */
+	std::thread controller(runLoop, robot_controller::run,
+			       std::string("robot_controller"));
+	std::thread master(runLoop, command_logic::run,
+			   std::string("command_logic"));
+
+	ROS_INFO("Teleoperation active: %d executor threads", threads);
+
+	ros::waitForShutdown();
+	master.join();
+	controller.join();
+
+	return 0;
+}
@@ -0,0 +1,29 @@
+/*! 
+ * \file rrtstar_node.h 
+ */ 
+
+#ifndef __RRTS_NODE_H_
+#define __RRTS_NODE_H_
+
+#include <ros/ros.h>
+
+
+namespace rrtstar_node {
+
+    /*!
+     * \brief Sets up the RRT* planner service
+     *
+     * Reads the planner parameters from the private handle pn, runs the
+     * warm-up plan and advertises rrtStarService on n. Returns without
+     * spinning, so that the planner can be served from another process
+     * (built with RRTSTAR_COMPONENT, which leaves out the main function).
+     *
+     * \param n Handle for the service and the statistics topic.
+     * \param pn Handle for the private parameters.
+     *
+     */
+    void setup (ros::NodeHandle& n, ros::NodeHandle& pn);
+}
+
+
+#endif
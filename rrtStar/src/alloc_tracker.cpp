@@ -0,0 +1,66 @@
+#include "alloc_tracker.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef RRTS_TRACK_ALLOCATIONS
+#include <atomic>
+
+// Services may be called from several spinner threads
+static std::atomic<long> bytesLive (0);
+static std::atomic<long> blocksLive (0);
+static std::atomic<long> numAllocations (0);
+
+// Every block is prefixed by its size, padded to keep the alignment of malloc
+#define HEADER_SIZE 16
+
+
+static void* trackedAlloc (std::size_t size) {
+    
+    char *block = (char*) malloc (size + HEADER_SIZE);
+    if (!block)
+        throw std::bad_alloc ();
+    
+    *((std::size_t*) block) = size;
+    bytesLive += size;
+    blocksLive++;
+    numAllocations++;
+    
+    return block + HEADER_SIZE;
+}
+
+
+static void trackedFree (void *ptr) {
+    
+    if (!ptr)
+        return;
+    
+    char *block = (char*) ptr - HEADER_SIZE;
+    bytesLive -= *((std::size_t*) block);
+    blocksLive--;
+    
+    free (block);
+}
+
+
+void* operator new (std::size_t size) {return trackedAlloc (size);}
+void* operator new[] (std::size_t size) {return trackedAlloc (size);}
+void operator delete (void *ptr) noexcept {trackedFree (ptr);}
+void operator delete[] (void *ptr) noexcept {trackedFree (ptr);}
+void operator delete (void *ptr, std::size_t) noexcept {trackedFree (ptr);}
+void operator delete[] (void *ptr, std::size_t) noexcept {trackedFree (ptr);}
+
+
+bool AllocTracker::isEnabled () {return true;}
+long AllocTracker::getBytesLive () {return bytesLive;}
+long AllocTracker::getBlocksLive () {return blocksLive;}
+long AllocTracker::getNumAllocations () {return numAllocations;}
+
+#else
+
+bool AllocTracker::isEnabled () {return false;}
+long AllocTracker::getBytesLive () {return 0;}
+long AllocTracker::getBlocksLive () {return 0;}
+long AllocTracker::getNumAllocations () {return 0;}
+
+#endif
@@ -0,0 +1,47 @@
+/*! 
+ * \file alloc_tracker.h 
+ *
+ * Counts the heap memory of the process when built with 
+ * RRTS_TRACK_ALLOCATIONS, by replacing the global operator new and 
+ * delete. Otherwise all counters read zero and nothing is replaced.
+ */ 
+
+#ifndef __RRTS_ALLOC_TRACKER_H_
+#define __RRTS_ALLOC_TRACKER_H_
+
+
+
+namespace AllocTracker {
+    
+    
+    /*!
+     * \brief Returns true if the allocation tracking is compiled in
+     *
+     * More elaborate description
+     */
+    bool isEnabled ();
+    
+    /*!
+     * \brief Returns the number of bytes currently allocated with operator new
+     *
+     * More elaborate description
+     */
+    long getBytesLive ();
+    
+    /*!
+     * \brief Returns the number of blocks currently allocated with operator new
+     *
+     * More elaborate description
+     */
+    long getBlocksLive ();
+    
+    /*!
+     * \brief Returns the total number of calls to operator new
+     *
+     * More elaborate description
+     */
+    long getNumAllocations ();
+}
+
+
+#endif
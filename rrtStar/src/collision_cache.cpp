@@ -0,0 +1,61 @@
+#include "collision_cache.h"
+
+using namespace SingleIntegrator;
+
+
+// Empty slot; a key hashing to it is moved to the next value
+#define EMPTY_SLOT 0ULL
+
+
+CollisionCache::CollisionCache (int numSlotsIn) {
+
+    unsigned long long numSlots = 1;
+    while (numSlots < (unsigned long long)numSlotsIn)
+        numSlots <<= 1;
+    mask = numSlots - 1;
+
+    slots = new std::atomic<unsigned long long>[numSlots];
+    for (unsigned long long i = 0; i < numSlots; i++)
+        slots[i].store (EMPTY_SLOT, std::memory_order_relaxed);
+}
+
+
+CollisionCache::~CollisionCache () {
+
+    delete [] slots;
+}
+
+
+unsigned long long CollisionCache::hash (unsigned long long hashIn, long long valueIn) {
+
+    // splitmix64 finalizer of the combined value
+    unsigned long long z = hashIn ^ ((unsigned long long)valueIn + 0x9e3779b97f4a7c15ULL + (hashIn << 6) + (hashIn >> 2));
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+
+int CollisionCache::lookup (unsigned long long keyIn) {
+
+    unsigned long long tag = keyIn & ~1ULL;
+    if (tag == EMPTY_SLOT)
+        tag = 2ULL;
+
+    // The slot from the high bits, the tag holds all the others
+    unsigned long long entry = slots[(keyIn >> 32) & mask].load (std::memory_order_relaxed);
+    if ( (entry & ~1ULL) != tag )
+        return -1;
+
+    return (int)(entry & 1ULL);
+}
+
+
+void CollisionCache::insert (unsigned long long keyIn, bool freeIn) {
+
+    unsigned long long tag = keyIn & ~1ULL;
+    if (tag == EMPTY_SLOT)
+        tag = 2ULL;
+
+    slots[(keyIn >> 32) & mask].store (tag | (freeIn ? 1ULL : 0ULL), std::memory_order_relaxed);
+}
@@ -0,0 +1,91 @@
+/*!
+ * \file collision_cache.h
+ *
+ * Bounded table of collision check results, shared by the requests of a
+ * node and safe to use from several threads without locks.
+ */
+
+#ifndef __RRTS_COLLISION_CACHE_H_
+#define __RRTS_COLLISION_CACHE_H_
+
+#include <atomic>
+
+
+
+namespace SingleIntegrator {
+
+
+    /*!
+     * \brief Collision cache class
+     *
+     * Direct-mapped table of 64-bit words, each holding the hash of a key
+     * and the result stored for it, written and read atomically: a lookup
+     * sees either a whole entry or none, whatever the other threads do. A
+     * new entry overwrites the one in its slot, so that the memory used is
+     * fixed. Keys are hashed by the caller; two keys with the same hash,
+     * but for the lowest bit, are taken as the same.
+     */
+    class CollisionCache {
+
+        std::atomic<unsigned long long> *slots;
+        unsigned long long mask;
+
+        // Owns the slots, not copyable
+        CollisionCache (const CollisionCache&);
+        CollisionCache& operator= (const CollisionCache&);
+
+    public:
+
+        /*!
+         * \brief CollisionCache constructor
+         *
+         * \param numSlotsIn Number of entries, rounded up to a power of two
+         *
+         */
+        CollisionCache (int numSlotsIn);
+
+        /*!
+         * \brief CollisionCache destructor
+         *
+         * More elaborate description
+         */
+        ~CollisionCache ();
+
+        /*!
+         * \brief Returns the number of entries
+         *
+         * More elaborate description
+         */
+        long getNumSlots () {return (long)mask + 1;}
+
+        /*!
+         * \brief Mixes a value into a hash
+         *
+         * \param hashIn The hash so far
+         * \param valueIn The value to mix in
+         *
+         */
+        static unsigned long long hash (unsigned long long hashIn, long long valueIn);
+
+        /*!
+         * \brief Returns the result stored for a key
+         *
+         * \param keyIn The hash of the key
+         *
+         * Returns 1 if free, 0 if in collision, -1 if not stored.
+         */
+        int lookup (unsigned long long keyIn);
+
+        /*!
+         * \brief Stores the result for a key
+         *
+         * \param keyIn The hash of the key
+         * \param freeIn Whether the key is collision-free
+         *
+         */
+        void insert (unsigned long long keyIn, bool freeIn);
+    };
+}
+
+
+#endif
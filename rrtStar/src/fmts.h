@@ -0,0 +1,262 @@
+/*!
+ * \file fmts.h
+ */
+
+#ifndef __FMTS_H_
+#define __FMTS_H_
+
+
+#include "rrts.h"
+
+#include <list>
+#include <vector>
+
+
+
+namespace FMTstar {
+
+
+    /*!
+     * \brief Static kd-tree over a batch of points
+     *
+     * Built once, in bulk, by median splits: the points are reordered so
+     * that every subtree is a contiguous range of one array, with its
+     * median in the middle. The tree is balanced, needs no node allocation
+     * and range queries walk contiguous memory.
+     */
+    class StaticKdTree {
+
+        int numDimensions;
+        std::vector<double> keys;
+        std::vector<int> indices;
+
+        void build (int begin, int end, int depth);
+        void nearRange (int begin, int end, int depth, const double* keyIn, double radius, std::vector<int>& indicesOut) const;
+
+    public:
+
+        /*!
+         * \brief Builds the tree over a batch of points
+         *
+         * \param numDimensionsIn Dimension of the points
+         * \param keysIn Coordinates of the points, numDimensionsIn per point
+         *
+         */
+        void build (int numDimensionsIn, const std::vector<double>& keysIn);
+
+        /*!
+         * \brief Returns the points within a radius of a point
+         *
+         * \param keyIn The coordinates of the query point
+         * \param radius The radius of the ball
+         * \param indicesOut The indices of the points in the ball (in the batch order)
+         *
+         */
+        void nearRange (const double* keyIn, double radius, std::vector<int>& indicesOut) const;
+    };
+
+
+    /*!
+     * \brief FMT* Planner class
+     *
+     * Fast Marching Tree: a batch of collision-free states is sampled up
+     * front, then the tree is marched outwards from the root in the order
+     * of increasing cost, as a lazy dynamic programming over the graph of
+     * the states closer than the connection radius. Each new state is only
+     * collision checked against its locally best parent, once, so that far
+     * fewer collision checks are needed than with RRT*. Suited to static
+     * scenes, where the whole batch can be drawn at once.
+     *
+     * Uses the same System interface as the RRT* planner, and its vertices.
+     */
+    template<class State, class Trajectory, class System>
+    class Planner {
+
+        typedef RRTstar::Vertex<State,Trajectory,System> vertex_t;
+
+        int numDimensions;
+
+        double gamma;
+        int numSamples;
+        int goalSampleInterval;
+
+        vertex_t *root;
+        vertex_t *lowerBoundVertex;
+        double lowerBoundCost;
+        int numGoalVertices;
+
+        std::vector<State> samples;
+        std::vector<vertex_t*> sampleVertices;
+        std::vector<char> sampleStatus;
+        std::vector< std::vector<int> > sampleNeighbors;
+        std::vector<char> hasNeighbors;
+        int goalSample;
+        double radius;
+        StaticKdTree kdtree;
+
+        RRTstar::Statistics statistics;
+
+        std::vector<int>& getNeighbors (int sampleIn);
+        vertex_t* insertTrajectory (vertex_t& vertexStartIn, Trajectory& trajectoryIn);
+        int getTrajectoryFromRoot (vertex_t& vertexIn, std::list<double*>& trajectoryOut);
+        int clearTree ();
+
+    public:
+
+        /*!
+         * \brief A list of all the vertices of the tree
+         *
+         * More elaborate description
+         */
+        std::list<vertex_t*> listVertices;
+
+        /*!
+         * \brief Number of vertices in the list
+         *
+         * More elaborate description
+         */
+        int numVertices;
+
+        /*!
+         * \brief Number of vertices in a goal tree (none, kept for the statistics)
+         *
+         * More elaborate description
+         */
+        int numVerticesGoal;
+
+        /*!
+         * \brief A pointer to the system class
+         *
+         * More elaborate description
+         */
+        System *system;
+
+        /*!
+         * \brief Planner constructor
+         *
+         * More elaborate description
+         */
+        Planner ();
+
+        /*!
+         * \brief Planner destructor
+         *
+         * More elaborate description
+         */
+        ~Planner ();
+
+        /*!
+         * \brief Sets the connection radius constant
+         *
+         * The radius is gamma (log n / n)^(1/d) in the state key space, as
+         * the near vertex radius of the RRT*.
+         *
+         * \param gammaIn The new value of the gamma parameter
+         *
+         */
+        int setGamma (double gammaIn);
+
+        /*!
+         * \brief Sets the number of states sampled in the batch
+         *
+         * \param numSamplesIn The number of collision-free states, the root excluded
+         *
+         */
+        int setNumSamples (int numSamplesIn);
+
+        /*!
+         * \brief Sets how often a sample is drawn from the goal region
+         *
+         * \param goalSampleIntervalIn The number of samples between goal samples, zero never
+         *
+         */
+        int setGoalSampleInterval (int goalSampleIntervalIn);
+
+        /*!
+         * \brief Sets the dynamical system used to sample and connect the states
+         *
+         * \param systemIn A reference to the dynamical system
+         *
+         */
+        int setSystem (System& systemIn);
+
+        /*!
+         * \brief Returns a reference to the root vertex
+         *
+         * More elaborate description
+         */
+        vertex_t& getRootVertex () {return *root;}
+
+        /*!
+         * \brief Samples the batch and builds the nearest neighbor structure
+         *
+         * The goal state of the system is part of the batch if it is
+         * collision-free.
+         */
+        int initialize ();
+
+        /*!
+         * \brief Marches the tree until the goal is reached
+         *
+         * Stops when the goal state is reached (or, if it is in collision,
+         * the first state of the goal region), which is then the cheapest
+         * one through the batch. Returns zero if the goal cannot be reached.
+         */
+        int run ();
+
+        /*!
+         * \brief Returns the cost of the vertex that reached the goal
+         *
+         * DBL_MAX if none did.
+         */
+        double getBestVertexCost () {return lowerBoundCost;}
+
+        /*!
+         * \brief Returns a reference to the vertex that reached the goal
+         *
+         * More elaborate description
+         */
+        vertex_t& getBestVertex () {return *lowerBoundVertex;}
+
+        /*!
+         * \brief Returns the trajectory to the vertex that reached the goal
+         *
+         * \param trajectoryOut The trajectory as a list of double arrays of
+         *                      dimension system->getNumDimensions()
+         *
+         */
+        int getBestTrajectory (std::list<double*>& trajectoryOut);
+
+        /*!
+         * \brief Returns the trajectory to the goal
+         *
+         * The trajectory to the goal state, which is the vertex that reached
+         * the goal. As with RRTstar::Planner, nothing is returned if the goal
+         * state is in collision, even though a vertex of the goal region may
+         * have been reached (see getBestTrajectory ()).
+         *
+         * \param trajectoryOut The trajectory as a list of double arrays of
+         *                      dimension system->getNumDimensions()
+         *
+         */
+        int getBestTrajectoryToGoal (std::list<double*>& trajectoryOut);
+
+        /*!
+         * \brief Returns the number of vertices that reach the goal region
+         *
+         * More elaborate description
+         */
+        int getNumGoalVertices () {return numGoalVertices;}
+
+        /*!
+         * \brief Returns the counters of the last run
+         *
+         * The iterations are the vertices expanded, the extensions the
+         * vertices added to the tree.
+         */
+        const RRTstar::Statistics& getStatistics () {return statistics;}
+    };
+
+}
+
+#endif
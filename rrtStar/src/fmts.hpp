@@ -0,0 +1,486 @@
+/*!
+ * \file fmts.hpp
+ */
+
+#ifndef __FMTS_HPP_
+#define __FMTS_HPP_
+
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+
+#include "fmts.h"
+
+
+
+/*!
+ * \brief Orders point indices along one dimension of their keys
+ */
+class CompareKeys {
+
+    const double *keys;
+    int numDimensions;
+    int dimension;
+
+public:
+
+    CompareKeys (const double *keysIn, int numDimensionsIn, int dimensionIn)
+        : keys (keysIn), numDimensions (numDimensionsIn), dimension (dimensionIn) {}
+
+    bool operator() (int i, int j) const {
+        return keys[i*numDimensions + dimension] < keys[j*numDimensions + dimension];
+    }
+};
+
+
+inline void
+FMTstar::StaticKdTree
+::build (int numDimensionsIn, const std::vector<double>& keysIn) {
+
+    numDimensions = numDimensionsIn;
+    int numPoints = keysIn.size()/numDimensions;
+
+    // Order the indices by median splits, then lay the keys out in that order
+    indices.resize (numPoints);
+    for (int i = 0; i < numPoints; i++)
+        indices[i] = i;
+    keys = keysIn;
+    build (0, numPoints, 0);
+
+    for (int i = 0; i < numPoints; i++)
+        for (int k = 0; k < numDimensions; k++)
+            keys[i*numDimensions + k] = keysIn[indices[i]*numDimensions + k];
+}
+
+
+inline void
+FMTstar::StaticKdTree
+::build (int begin, int end, int depth) {
+
+    if (end - begin <= 1)
+        return;
+
+    // The median along the split dimension goes in the middle of the range
+    int middle = (begin + end)/2;
+    std::nth_element (indices.begin() + begin, indices.begin() + middle, indices.begin() + end,
+                      CompareKeys (&keys[0], numDimensions, depth % numDimensions));
+
+    build (begin, middle, depth + 1);
+    build (middle + 1, end, depth + 1);
+}
+
+
+inline void
+FMTstar::StaticKdTree
+::nearRange (const double* keyIn, double radius, std::vector<int>& indicesOut) const {
+
+    indicesOut.clear();
+    if (!indices.empty())
+        nearRange (0, indices.size(), 0, keyIn, radius, indicesOut);
+}
+
+
+inline void
+FMTstar::StaticKdTree
+::nearRange (int begin, int end, int depth, const double* keyIn, double radius, std::vector<int>& indicesOut) const {
+
+    if (begin >= end)
+        return;
+
+    int middle = (begin + end)/2;
+    const double *keyMiddle = &keys[middle*numDimensions];
+
+    double dist = 0.0;
+    for (int k = 0; k < numDimensions; k++)
+        dist += (keyIn[k] - keyMiddle[k])*(keyIn[k] - keyMiddle[k]);
+    if (dist <= radius*radius)
+        indicesOut.push_back (indices[middle]);
+
+    // Only the sides of the split the ball reaches
+    double diff = keyIn[depth % numDimensions] - keyMiddle[depth % numDimensions];
+    if (diff - radius <= 0.0)
+        nearRange (begin, middle, depth + 1, keyIn, radius, indicesOut);
+    if (diff + radius >= 0.0)
+        nearRange (middle + 1, end, depth + 1, keyIn, radius, indicesOut);
+}
+
+
+
+/* Status of a sample during the march */
+#define FMTS_UNVISITED 0
+#define FMTS_OPEN 1
+#define FMTS_CLOSED 2
+
+
+template<class State, class Trajectory, class System>
+FMTstar::Planner<State, Trajectory, System>
+::Planner () {
+
+    gamma = 1.0;
+    numSamples = 1000;
+    goalSampleInterval = 0;
+
+    root = NULL;
+    lowerBoundVertex = NULL;
+    lowerBoundCost = DBL_MAX;
+    numGoalVertices = 0;
+
+    goalSample = -1;
+    radius = 0.0;
+
+    numVertices = 0;
+    numVerticesGoal = 0;
+
+    system = NULL;
+}
+
+
+template<class State, class Trajectory, class System>
+FMTstar::Planner<State, Trajectory, System>
+::~Planner () {
+
+    clearTree ();
+    if (root)
+        delete root;
+}
+
+
+template<class State, class Trajectory, class System>
+int
+FMTstar::Planner<State, Trajectory, System>
+::clearTree () {
+
+    // Delete all the vertices but the root
+    for (typename std::list<vertex_t*>::iterator iter = listVertices.begin(); iter != listVertices.end(); iter++)
+        if (*iter != root)
+            delete *iter;
+    listVertices.clear();
+    numVertices = 0;
+
+    if (root) {
+        root->parent = NULL;
+        root->children.clear();
+    }
+
+    lowerBoundVertex = NULL;
+    lowerBoundCost = DBL_MAX;
+    numGoalVertices = 0;
+
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int
+FMTstar::Planner<State, Trajectory, System>
+::setGamma (double gammaIn) {
+
+    if (gammaIn < 0.0)
+        return 0;
+
+    gamma = gammaIn;
+
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int
+FMTstar::Planner<State, Trajectory, System>
+::setNumSamples (int numSamplesIn) {
+
+    if (numSamplesIn < 1)
+        return 0;
+
+    numSamples = numSamplesIn;
+
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int
+FMTstar::Planner<State, Trajectory, System>
+::setGoalSampleInterval (int goalSampleIntervalIn) {
+
+    if (goalSampleIntervalIn < 0)
+        return 0;
+
+    goalSampleInterval = goalSampleIntervalIn;
+
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int
+FMTstar::Planner<State, Trajectory, System>
+::setSystem (System& systemIn) {
+
+    // The system is owned by the caller
+    system = &systemIn;
+
+    numDimensions = system->getNumDimensions ();
+
+    // Delete all the vertices, including the previous root
+    clearTree ();
+    if (root)
+        delete root;
+
+    // Initialize the root vertex
+    root = new vertex_t;
+    root->state = new State (system->getRootState());
+    root->costFromParent = 0.0;
+    root->costFromRoot = 0.0;
+    root->trajFromParent = NULL;
+
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int
+FMTstar::Planner<State, Trajectory, System>
+::initialize () {
+
+    // If there is no system or root, then return failure
+    if ( (!system) || (!root) )
+        return 0;
+
+    clearTree ();
+    statistics.clear();
+    numDimensions = system->getNumDimensions();
+
+    // The batch: the root, the goal state if free, then the free samples
+    samples.clear();
+    samples.reserve (numSamples + 2);
+    samples.push_back (root->getState());
+    goalSample = -1;
+    State stateGoal;
+    if (system->getGoalState (stateGoal) > 0) {
+        goalSample = samples.size();
+        samples.push_back (stateGoal);
+    }
+
+    State stateRandom;
+    int numAttempts = 0;
+    int numFree = 0;
+    while ( (numFree < numSamples) && (numAttempts < 10*numSamples) ) {
+        numAttempts++;
+        bool goalDraw = (goalSampleInterval > 0) && (numAttempts % goalSampleInterval == 0);
+        int free = goalDraw ? system->sampleGoalState (stateRandom) : system->sampleState (stateRandom);
+        if (free <= 0)
+            continue;
+        samples.push_back (stateRandom);
+        numFree++;
+    }
+
+    // Build the nearest neighbor structure once, in bulk
+    int numStates = samples.size();
+    std::vector<double> keys (numStates*numDimensions);
+    for (int i = 0; i < numStates; i++)
+        system->getStateKey (samples[i], &keys[i*numDimensions]);
+    kdtree.build (numDimensions, keys);
+
+    radius = gamma * pow (log ((double)numStates)/((double)numStates), 1.0/((double)numDimensions));
+
+    sampleVertices.assign (numStates, (vertex_t*) NULL);
+    sampleStatus.assign (numStates, FMTS_UNVISITED);
+    sampleNeighbors.assign (numStates, std::vector<int>());
+    hasNeighbors.assign (numStates, 0);
+
+    // The root starts the march
+    sampleVertices[0] = root;
+    listVertices.push_back (root);
+    numVertices++;
+    root->reachingTarget = system->isReachingTarget (root->getState());
+    if (root->reachingTarget)
+        numGoalVertices++;
+
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+std::vector<int>&
+FMTstar::Planner<State, Trajectory, System>
+::getNeighbors (int sampleIn) {
+
+    // Computed once per sample, on first use
+    if (!hasNeighbors[sampleIn]) {
+        std::vector<double> key (numDimensions);
+        system->getStateKey (samples[sampleIn], &key[0]);
+        kdtree.nearRange (&key[0], radius, sampleNeighbors[sampleIn]);
+        hasNeighbors[sampleIn] = 1;
+        statistics.numNearestQueries++;
+    }
+
+    return sampleNeighbors[sampleIn];
+}
+
+
+template<class State, class Trajectory, class System>
+RRTstar::Vertex<State,Trajectory,System>*
+FMTstar::Planner<State, Trajectory, System>
+::insertTrajectory (vertex_t& vertexStartIn, Trajectory& trajectoryIn) {
+
+    vertex_t *vertexNew = new vertex_t;
+    vertexNew->state = new State (trajectoryIn.getEndState());
+    vertexNew->costFromParent = trajectoryIn.evaluateCost();
+    vertexNew->costFromRoot = vertexStartIn.costFromRoot + vertexNew->costFromParent;
+    vertexNew->trajFromParent = new Trajectory (std::move (trajectoryIn));
+    vertexNew->parent = &vertexStartIn;
+    vertexStartIn.children.insert (vertexNew);
+
+    vertexNew->reachingTarget = system->isReachingTarget (vertexNew->getState());
+    if (vertexNew->reachingTarget)
+        numGoalVertices++;
+
+    listVertices.push_front (vertexNew);
+    numVertices++;
+
+    return vertexNew;
+}
+
+
+template<class State, class Trajectory, class System>
+int
+FMTstar::Planner<State, Trajectory, System>
+::run () {
+
+    typedef std::pair<double,int> entry_t;
+    std::priority_queue< entry_t, std::vector<entry_t>, std::greater<entry_t> > heapOpen;
+    std::vector<int> vectorOpenedNow;
+
+    if (sampleVertices.empty())
+        return 0;
+
+    sampleStatus[0] = FMTS_OPEN;
+    heapOpen.push (entry_t (0.0, 0));
+
+    while (!heapOpen.empty()) {
+
+        // 1. Expand the cheapest open vertex
+        int z = heapOpen.top().second;
+        heapOpen.pop();
+        vertex_t *vertexZ = sampleVertices[z];
+        statistics.numIterations++;
+
+        // 2. Stop at the goal: it is reached at its lowest cost through the batch
+        if ( (z == goalSample) || ( (goalSample < 0) && vertexZ->reachingTarget ) ) {
+            lowerBoundVertex = vertexZ;
+            lowerBoundCost = vertexZ->costFromRoot;
+            statistics.vectorBestCostIterations.push_back (statistics.numIterations);
+            statistics.vectorBestCosts.push_back (lowerBoundCost);
+            return 1;
+        }
+
+        // 3. Connect the unvisited neighbors through their best open neighbor
+        vectorOpenedNow.clear();
+        std::vector<int>& neighborsZ = getNeighbors (z);
+        for (int n = 0; n < neighborsZ.size(); n++) {
+
+            int x = neighborsZ[n];
+            if (sampleStatus[x] != FMTS_UNVISITED)
+                continue;
+
+            // The locally best parent, without collision checking
+            std::vector<int>& neighborsX = getNeighbors (x);
+            int yBest = -1;
+            double costBest = DBL_MAX;
+            for (int m = 0; m < neighborsX.size(); m++) {
+                int y = neighborsX[m];
+                if (sampleStatus[y] != FMTS_OPEN)
+                    continue;
+                bool exactConnection = false;
+                double cost = sampleVertices[y]->costFromRoot
+                    + system->evaluateExtensionCost (samples[y], samples[x], exactConnection);
+                if (cost < costBest) {
+                    costBest = cost;
+                    yBest = y;
+                }
+            }
+            if (yBest < 0)
+                continue;
+
+            // Lazy: only that connection is checked, x waits for another z if it fails
+            Trajectory trajectory;
+            bool exactConnection = false;
+            statistics.numCollisionChecks++;
+            if (system->extendTo (samples[yBest], samples[x], trajectory, exactConnection) <= 0)
+                continue;
+
+            sampleVertices[x] = insertTrajectory (*(sampleVertices[yBest]), trajectory);
+            statistics.numExtensions++;
+            vectorOpenedNow.push_back (x);
+        }
+
+        // 4. The new vertices join the open set, z leaves it
+        for (int n = 0; n < vectorOpenedNow.size(); n++) {
+            int x = vectorOpenedNow[n];
+            sampleStatus[x] = FMTS_OPEN;
+            heapOpen.push (entry_t (sampleVertices[x]->costFromRoot, x));
+        }
+        sampleStatus[z] = FMTS_CLOSED;
+    }
+
+    return 0;
+}
+
+
+template<class State, class Trajectory, class System>
+int
+FMTstar::Planner<State, Trajectory, System>
+::getTrajectoryFromRoot (vertex_t& vertexIn, std::list<double*>& trajectoryOut) {
+
+    std::list<double*> trajectoryFromRoot;
+    for (vertex_t* vertexCurr = &vertexIn; vertexCurr->parent; vertexCurr = vertexCurr->parent) {
+        std::list<double*> trajectory;
+        system->getTrajectory (vertexCurr->parent->getState(), vertexCurr->getState(), trajectory);
+        trajectoryFromRoot.splice (trajectoryFromRoot.begin(), trajectory);
+    }
+    trajectoryOut.splice (trajectoryOut.end(), trajectoryFromRoot);
+
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int
+FMTstar::Planner<State, Trajectory, System>
+::getBestTrajectory (std::list<double*>& trajectoryOut) {
+
+    if (lowerBoundVertex == NULL) {
+        std::cout<<"NULL-> getBestTrajectory (FMT*) "<<std::endl;
+        return 0;
+    }
+
+    return getTrajectoryFromRoot (*lowerBoundVertex, trajectoryOut);
+}
+
+
+template<class State, class Trajectory, class System>
+int
+FMTstar::Planner<State, Trajectory, System>
+::getBestTrajectoryToGoal (std::list<double*>& trajectoryOut) {
+
+    // Not in the batch: the goal state is in collision
+    if (goalSample < 0) {
+        std::cout<<"Goal state in collision -> getBestTrajectoryToGoal (FMT*) "<<std::endl;
+        return 0;
+    }
+
+    if ( (lowerBoundVertex == NULL) || (lowerBoundVertex != sampleVertices[goalSample]) ) {
+        std::cout<<"NULL-> getBestTrajectoryToGoal (FMT*) "<<std::endl;
+        return 0;
+    }
+
+    return getTrajectoryFromRoot (*lowerBoundVertex, trajectoryOut);
+}
+
+
+#endif
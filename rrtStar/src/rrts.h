@@ -8,12 +8,22 @@
 
 #include "kdtree.h"
 
+#include <algorithm>
 #include <list>
 #include <set>
 #include <vector>
 
 
 
+namespace FMTstar {
+
+
+    template<class State, class Trajectory, class System>
+    class Planner;
+
+}
+
+
 namespace RRTstar {
 
 
@@ -21,6 +31,72 @@ namespace RRTstar {
     class Planner;
 
 
+    /*!
+     * \brief RRT* Statistics class
+     *
+     * Counters of the planner hot path. They are plain members of one
+     * planner instance, which is only used by one thread at a time, so
+     * updating them costs a single increment.
+     */
+    class Statistics {
+        
+    public:
+        
+        /*!
+         * \brief Number of calls to iteration ()
+         */
+        long numIterations;
+        
+        /*!
+         * \brief Number of iterations that added a vertex to a tree
+         */
+        long numExtensions;
+        
+        /*!
+         * \brief Number of trajectories checked for collision with System::extendTo
+         */
+        long numCollisionChecks;
+        
+        /*!
+         * \brief Number of nearest and near neighbor queries on the kdtrees
+         */
+        long numNearestQueries;
+        
+        /*!
+         * \brief Number of successful rewirings
+         */
+        long numRewires;
+        
+        /*!
+         * \brief The iterations at which the best cost improved
+         */
+        std::vector<long> vectorBestCostIterations;
+        
+        /*!
+         * \brief The best cost after each improvement
+         */
+        std::vector<double> vectorBestCosts;
+        
+        /*!
+         * \brief Statistics constructor
+         */
+        Statistics () {clear ();}
+        
+        /*!
+         * \brief Resets all counters
+         */
+        void clear () {
+            numIterations = 0;
+            numExtensions = 0;
+            numCollisionChecks = 0;
+            numNearestQueries = 0;
+            numRewires = 0;
+            vectorBestCostIterations.clear();
+            vectorBestCosts.clear();
+        }
+    };
+
+
     /*!
      * \brief RRT* Vertex class
      *
@@ -35,6 +111,8 @@ namespace RRTstar {
         double costFromParent;
         double costFromRoot;
         Trajectory *trajFromParent;
+        bool inGoalTree;
+        bool reachingTarget;
     
 
     public:
@@ -90,8 +168,24 @@ namespace RRTstar {
          * More elaborate description
          */
         double getCost () {return costFromRoot;}
+        
+        /*!
+         * \brief Returns true if the vertex belongs to the tree grown from the goal
+         *
+         * In the bidirectional mode the cost of a goal tree vertex is the 
+         * cost-to-go to the goal state rather than the cost from the root.
+         */
+        bool isInGoalTree () {return inGoalTree;}
+        
+        /*!
+         * \brief Returns true if the state of the vertex lies in the goal region
+         *
+         * Evaluated once when the vertex is created.
+         */
+        bool isReachingTarget () {return reachingTarget;}
     
         friend class Planner<State,Trajectory,System>;
+        friend class FMTstar::Planner<State,Trajectory,System>;
     };
 
     
@@ -120,10 +214,27 @@ namespace RRTstar {
         
         vertex_t *root;
         
+        bool bidirectional;
+        bool growGoalTree;
+        KdTree *kdtreeGoal;
+        vertex_t *rootGoal;
+        
+        vertex_t *bridgeVertexStart;
+        vertex_t *bridgeVertexGoal;
+        double bridgeCost;
+        
+        int goalSampleInterval;
+        int numStartTreeSamples;
+        std::vector<vertex_t*> vectorGoalVertices;
+        
+        Statistics statistics;
+        
         int insertIntoKdtree (vertex_t &vertexIn);
         
-        int getNearestVertex (State& stateIn, vertex_t*& vertexPointerOut);    
-        int getNearVertices (State& stateIn, std::vector<vertex_t*>& vectorNearVerticesOut);
+        int extendTo (State& stateFromIn, State& stateTowardsIn, Trajectory& trajectoryOut, bool& exactConnectionOut);
+        
+        int getNearestVertex (State& stateIn, vertex_t*& vertexPointerOut, bool goalTree = false);    
+        int getNearVertices (State& stateIn, std::vector<vertex_t*>& vectorNearVerticesOut, bool goalTree = false);
         
         int checkUpdateBestVertex (vertex_t& vertexIn);
         
@@ -135,6 +246,14 @@ namespace RRTstar {
     
         int updateBranchCost (vertex_t& vertexIn, int depth);    
         int rewireVertices (vertex_t& vertexNew, std::vector<vertex_t*>& vectorNearVertices); 
+        
+        int extendTree (State& stateIn, bool goalTree, vertex_t*& vertexNewOut);
+        int connectTrees (vertex_t& vertexNew);
+        double evaluateBridgeCost ();
+        int getBridgeTrajectory (std::list<double*>& trajectoryOut);
+        int getTrajectoryFromRoot (vertex_t& vertexIn, std::list<double*>& trajectoryOut);
+        int clearTree (bool keepRoot);
+        int clearGoalTree ();
 
     
     public:
@@ -153,6 +272,22 @@ namespace RRTstar {
          * More elaborate description
          */
         int numVertices;
+        
+        
+        /*!
+         * \brief A list of all the vertices of the goal tree
+         *
+         * Only populated in the bidirectional mode.
+         */
+        std::list<vertex_t*> listVerticesGoal;
+        
+        
+        /*!
+         * \brief Number of vertices in the goal tree
+         *
+         * More elaborate description
+         */
+        int numVerticesGoal;
     
         
         /*!
@@ -201,6 +336,34 @@ namespace RRTstar {
         int setSystem (System& system);
         
         
+        /*!
+         * \brief Enables the bidirectional (RRT*-Connect) mode
+         *
+         * A second tree is grown from the goal state of the system and the
+         * two trees are alternately extended towards the same samples and 
+         * connected to each other. Both trees are rewired. The steering 
+         * function of the system is assumed to be symmetric.
+         * Takes effect on the next call to initialize ().
+         *
+         * \param bidirectionalIn True to grow a tree from the goal as well
+         *
+         */
+        int setBidirectional (bool bidirectionalIn);
+        
+        
+        /*!
+         * \brief Sets how often a sample is drawn from the goal region
+         *
+         * Every goalSampleIntervalIn-th iteration the random state is replaced 
+         * by a sample of the goal region of the system. Zero disables goal
+         * sampling.
+         *
+         * \param goalSampleIntervalIn The number of iterations between goal samples
+         *
+         */
+        int setGoalSampleInterval (int goalSampleIntervalIn);
+        
+        
         /*!
          * \brief Returns a reference to the root vertex
          *
@@ -228,7 +391,7 @@ namespace RRTstar {
          *
          * More elaborate description
          */
-        double getBestVertexCost () {return lowerBoundCost;}
+        double getBestVertexCost () {return std::min (lowerBoundCost, evaluateBridgeCost ());}
         
         /*!
          * \brief Returns a reference to the best vertex in the RRT*
@@ -248,6 +411,35 @@ namespace RRTstar {
          *
          */
         int getBestTrajectory (std::list<double*>& trajectory);
+        
+        /*!
+         * \brief Returns the best trajectory that ends exactly at the goal state
+         *
+         * The vertices that reach the goal region are tried in the order of 
+         * increasing total cost, and the first one that can be connected to 
+         * the goal state of the system without collision is used. Returns 
+         * zero if no such trajectory exists.
+         *
+         * \param trajectory The trajectory that contains the best trajectory as a 
+         *                   list of double arrays of dimension system->getNumDimensions(),
+         *                   with the goal state as its last element
+         *
+         */
+        int getBestTrajectoryToGoal (std::list<double*>& trajectory);
+        
+        /*!
+         * \brief Returns the number of vertices that reach the goal region
+         *
+         * More elaborate description
+         */
+        int getNumGoalVertices () {return vectorGoalVertices.size();}
+        
+        /*!
+         * \brief Returns the counters collected since the last initialize ()
+         *
+         * More elaborate description
+         */
+        const Statistics& getStatistics () {return statistics;}
     };
 
 }
@@ -9,6 +9,7 @@
 #include <cfloat>
 #include <cmath>
 #include <algorithm>
+#include <utility>
 
 
 #include "rrts.h"
@@ -25,6 +26,9 @@ RRTstar::Vertex<State, Trajectory, System>
     
     costFromParent = 0.0;
     costFromRoot = 0.0;
+    
+    inGoalTree = false;
+    reachingTarget = false;
 }
 
 
@@ -58,6 +62,8 @@ RRTstar::Vertex<State, Trajectory, System>
         trajFromParent = new Trajectory (*(vertexIn.trajFromParent));
     else 
         trajFromParent = NULL;
+    inGoalTree = vertexIn.inGoalTree;
+    reachingTarget = vertexIn.reachingTarget;
 }
 
 
@@ -82,6 +88,19 @@ RRTstar::Planner<State, Trajectory, System>
     
     numVertices = 0;
     
+    bidirectional = false;
+    growGoalTree = false;
+    kdtreeGoal = NULL;
+    rootGoal = NULL;
+    numVerticesGoal = 0;
+    
+    bridgeVertexStart = NULL;
+    bridgeVertexGoal = NULL;
+    bridgeCost = DBL_MAX;
+    
+    goalSampleInterval = 0;
+    numStartTreeSamples = 0;
+    
     system = NULL;
 }
 
@@ -90,16 +109,11 @@ template<class State, class Trajectory, class System>
 RRTstar::Planner<State, Trajectory, System>
 ::~Planner () {
     
-    // Delete the kdtree structure
-    if (kdtree) {
-        kd_clear (kdtree);
-        kd_free (kdtree);
-    }
-    
-    // Delete all the vertices
-    for (typename std::list<Vertex <State,Trajectory,System> * >::iterator iter = listVertices.begin(); iter != listVertices.end(); iter++) 
-        delete *iter;
+    // Delete all the vertices, the root and the kdtree structure
+    clearTree (false);
     
+    // Delete the goal tree
+    clearGoalTree ();
 }
 
 
@@ -110,24 +124,36 @@ RRTstar::Planner<State, Trajectory, System>
     
     double *stateKey = new double[numDimensions];
     system->getStateKey ( *(vertexIn.state), stateKey);
-    kd_insert (kdtree, stateKey, &vertexIn);
+    kd_insert (vertexIn.inGoalTree ? kdtreeGoal : kdtree, stateKey, &vertexIn);
     delete [] stateKey;
     
     return 1;
 }
 
 
+template<class State, class Trajectory, class System>
+int 
+RRTstar::Planner<State, Trajectory, System>
+::extendTo (State& stateFromIn, State& stateTowardsIn, Trajectory& trajectoryOut, bool& exactConnectionOut) {
+    
+    statistics.numCollisionChecks++;
+    
+    return system->extendTo (stateFromIn, stateTowardsIn, trajectoryOut, exactConnectionOut);
+}
+
+
 template<class State, class Trajectory, class System>
 int 
 RRTstar::Planner<State,Trajectory,System>
-::getNearestVertex (State& stateIn, Vertex<State,Trajectory,System>*& vertexPointerOut) {
+::getNearestVertex (State& stateIn, Vertex<State,Trajectory,System>*& vertexPointerOut, bool goalTree) {
     
     // Get the state key for the query state
     double *stateKey = new double[numDimensions];
     system->getStateKey (stateIn, stateKey);
     
     // Search the kdtree for the nearest vertex
-    KdRes *kdres = kd_nearest (kdtree, stateKey);
+    KdRes *kdres = kd_nearest (goalTree ? kdtreeGoal : kdtree, stateKey);
+    statistics.numNearestQueries++;
     if (kd_res_end (kdres))  
         vertexPointerOut = NULL;
     vertexPointerOut = (Vertex<State,Trajectory,System>*) kd_res_item_data (kdres);
@@ -147,23 +173,26 @@ RRTstar::Planner<State,Trajectory,System>
 template<class State, class Trajectory, class System>
 int 
 RRTstar::Planner<State, Trajectory, System>
-::getNearVertices (State& stateIn, std::vector< Vertex<State,Trajectory,System>* >& vectorNearVerticesOut) {
+::getNearVertices (State& stateIn, std::vector< Vertex<State,Trajectory,System>* >& vectorNearVerticesOut, bool goalTree) {
     
     // Get the state key for the query state
     double *stateKey = new double[numDimensions];
     system->getStateKey (stateIn, stateKey);
     
     // Compute the ball radius
-    double ballRadius = gamma * pow( log((double)(numVertices + 1.0))/((double)(numVertices + 1.0)), 1.0/((double)numDimensions) );
+    int numVerticesTree = goalTree ? numVerticesGoal : numVertices;
+    double ballRadius = gamma * pow( log((double)(numVerticesTree + 1.0))/((double)(numVerticesTree + 1.0)), 1.0/((double)numDimensions) );
     
     // Search kdtree for the set of near vertices
-    KdRes *kdres = kd_nearest_range (kdtree, stateKey, ballRadius);
+    KdRes *kdres = kd_nearest_range (goalTree ? kdtreeGoal : kdtree, stateKey, ballRadius);
+    statistics.numNearestQueries++;
     delete [] stateKey;
     
     // Create the vector data structure for storing the results
     int numNearVertices = kd_res_size (kdres);
     if (numNearVertices == 0) {
         vectorNearVerticesOut.clear();
+        kd_res_free (kdres);
         return 1;
     }
     vectorNearVerticesOut.resize(numNearVertices);
@@ -190,7 +219,8 @@ int
 RRTstar::Planner<State, Trajectory, System>
 ::checkUpdateBestVertex (Vertex<State,Trajectory,System>& vertexIn) {
     
-    if (system->isReachingTarget(vertexIn.getState())){
+    // Only the vertices found in the goal region on insertion can be the best
+    if (vertexIn.reachingTarget){
         
         
         double costCurr = vertexIn.getCost();
@@ -211,7 +241,7 @@ RRTstar::Planner<State, Trajectory, System>
 ::insertTrajectory (Vertex<State,Trajectory,System>& vertexStartIn, Trajectory& trajectoryIn) {
     
     // Check for admissible cost-to-go
-    if (lowerBoundVertex != NULL) {
+    if ( (lowerBoundVertex != NULL) && (!vertexStartIn.inGoalTree) ) {
         double costToGo = system->evaluateCostToGo (trajectoryIn.getEndState());
         if (costToGo >= 0.0) 
             if (lowerBoundCost < vertexStartIn.getCost() + costToGo) 
@@ -222,10 +252,23 @@ RRTstar::Planner<State, Trajectory, System>
     Vertex<State,Trajectory,System>* vertexNew = new Vertex<State,Trajectory,System>;
     vertexNew->state = new State;
     vertexNew->parent = NULL;
+    vertexNew->inGoalTree = vertexStartIn.inGoalTree;
     vertexNew->getState() = trajectoryIn.getEndState();
     insertIntoKdtree (*vertexNew);  
-    this->listVertices.push_front (vertexNew);
-    this->numVertices++;
+    if (vertexNew->inGoalTree) {
+        this->listVerticesGoal.push_front (vertexNew);
+        this->numVerticesGoal++;
+    }
+    else {
+        this->listVertices.push_front (vertexNew);
+        this->numVertices++;
+        
+        // The goal test is done once per vertex, rewiring does not move it
+        if (system->isReachingTarget (vertexNew->getState())) {
+            vertexNew->reachingTarget = true;
+            vectorGoalVertices.push_back (vertexNew);
+        }
+    }
     
     // Insert the trajectory between the start and end vertices
     insertTrajectory (vertexStartIn, trajectoryIn, *vertexNew);
@@ -244,10 +287,12 @@ RRTstar::Planner<State, Trajectory, System>
     vertexEndIn.costFromRoot = vertexStartIn.costFromRoot + vertexEndIn.costFromParent;
     checkUpdateBestVertex (vertexEndIn);
     
-    // Update the trajectory between the two vertices
+    // Move the trajectory between the two vertices into the tree, 
+    // reusing the edge object of a rewired vertex
     if (vertexEndIn.trajFromParent)
-        delete vertexEndIn.trajFromParent;
-    vertexEndIn.trajFromParent = new Trajectory (trajectoryIn);
+        *(vertexEndIn.trajFromParent) = std::move (trajectoryIn);
+    else
+        vertexEndIn.trajFromParent = new Trajectory (std::move (trajectoryIn));
     
     // Update the parent to the end vertex
     if (vertexEndIn.parent)
@@ -266,33 +311,59 @@ int
 RRTstar::Planner<State, Trajectory, System>
 ::setSystem (System& systemIn) {
     
-    if (system)
-        delete system;
-    
+    // The system is owned by the caller
     system = &systemIn;
     
     numDimensions = system->getNumDimensions ();
     
-    // Delete all the vertices
+    // Delete all the vertices, including the previous root
+    clearTree (false);
+    kdtree = kd_create (numDimensions);
+    
+    // Initialize the root vertex
+    root = new Vertex<State,Trajectory,System>;
+    root->state = new State (system->getRootState());
+    root->costFromParent = 0.0;
+    root->costFromRoot = 0.0;
+    root->trajFromParent = NULL;
+    
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int 
+RRTstar::Planner<State, Trajectory, System>
+::clearTree (bool keepRoot) {
+    
+    // Delete all the vertices, the root may not be in the list yet
     for (typename std::list< Vertex<State,Trajectory,System>* >::iterator iter = listVertices.begin(); iter != listVertices.end(); iter++)
-        delete *iter;
+        if (*iter != root)
+            delete *iter;
+    listVertices.clear();
     numVertices = 0;
+    
+    if (root) {
+        if (keepRoot) {
+            root->parent = NULL;
+            root->children.clear();
+        }
+        else {
+            delete root;
+            root = NULL;
+        }
+    }
+    
     lowerBoundCost = DBL_MAX;
     lowerBoundVertex = NULL;
+    vectorGoalVertices.clear();
     
     // Clear the kdtree
     if (kdtree) {
         kd_clear (kdtree);
         kd_free (kdtree);
+        kdtree = NULL;
     }
-    kdtree = kd_create (numDimensions);
-    
-    // Initialize the root vertex
-    root = new Vertex<State,Trajectory,System>;
-    root->state = new State (system->getRootState());
-    root->costFromParent = 0.0;
-    root->costFromRoot = 0.0;
-    root->trajFromParent = NULL;
     
     return 1;
 }
@@ -318,29 +389,15 @@ RRTstar::Planner<State, Trajectory, System>
     if (!system)
         return 0;
     
-    // Backup the root
-    Vertex<State,Trajectory,System> *rootBackup = NULL;
-    if (root)
-        rootBackup = new Vertex<State,Trajectory,System> (*root);
+    // Delete all the vertices but keep the root
+    clearTree (true);
+    numStartTreeSamples = 0;
+    statistics.clear();
     
-    // Delete all the vertices
-    for (typename std::list< Vertex<State,Trajectory,System>* >::iterator iter = listVertices.begin(); iter != listVertices.end(); iter++)
-        delete *iter;
-    listVertices.clear();
-    numVertices = 0;
-    lowerBoundCost = DBL_MAX;
-    lowerBoundVertex = NULL;
-    
-    // Clear the kdtree
-    if (kdtree) {
-        kd_clear (kdtree);
-        kd_free (kdtree);
-    }
     kdtree = kd_create (system->getNumDimensions());
     
     // Initialize the variables
     numDimensions = system->getNumDimensions();
-    root = rootBackup;
     if (root){
         listVertices.push_back(root);
         insertIntoKdtree (*root);
@@ -348,6 +405,79 @@ RRTstar::Planner<State, Trajectory, System>
     }
     lowerBoundCost = DBL_MAX;
     lowerBoundVertex = NULL;
+    if (root) {
+        root->reachingTarget = system->isReachingTarget (root->getState());
+        if (root->reachingTarget) {
+            vectorGoalVertices.push_back (root);
+            checkUpdateBestVertex (*root);
+        }
+    }
+    
+    // Initialize the goal tree, rooted at the goal state
+    clearGoalTree ();
+    if (bidirectional) {
+        kdtreeGoal = kd_create (numDimensions);
+        growGoalTree = false;
+        State stateGoal;
+        if (system->getGoalState (stateGoal) > 0) {
+            rootGoal = new Vertex<State,Trajectory,System>;
+            rootGoal->state = new State (stateGoal);
+            rootGoal->inGoalTree = true;
+            listVerticesGoal.push_back (rootGoal);
+            insertIntoKdtree (*rootGoal);
+            numVerticesGoal++;
+        }
+    }
+    
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int 
+RRTstar::Planner<State, Trajectory, System>
+::clearGoalTree () {
+    
+    for (typename std::list< Vertex<State,Trajectory,System>* >::iterator iter = listVerticesGoal.begin(); iter != listVerticesGoal.end(); iter++)
+        delete *iter;
+    listVerticesGoal.clear();
+    numVerticesGoal = 0;
+    rootGoal = NULL;
+    
+    if (kdtreeGoal) {
+        kd_clear (kdtreeGoal);
+        kd_free (kdtreeGoal);
+        kdtreeGoal = NULL;
+    }
+    
+    bridgeVertexStart = NULL;
+    bridgeVertexGoal = NULL;
+    bridgeCost = DBL_MAX;
+    
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int 
+RRTstar::Planner<State, Trajectory, System>
+::setBidirectional (bool bidirectionalIn) {
+    
+    bidirectional = bidirectionalIn;
+    
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int 
+RRTstar::Planner<State, Trajectory, System>
+::setGoalSampleInterval (int goalSampleIntervalIn) {
+    
+    if (goalSampleIntervalIn < 0)
+        return 0;
+    
+    goalSampleInterval = goalSampleIntervalIn;
     
     return 1;
 }
@@ -410,7 +540,7 @@ RRTstar::Planner<State, Trajectory, System>
         
         // Extend the current vertex towards stateIn (and this time check for collision with obstacles)
         exactConnection = false;
-        if (system->extendTo(*(vertexCurr->state), stateIn, trajectoryOut, exactConnection) > 0) {
+        if (extendTo (*(vertexCurr->state), stateIn, trajectoryOut, exactConnection) > 0) {
             vertexBest = vertexCurr;
             connectionEstablished = true;
             break;
@@ -475,11 +605,12 @@ RRTstar::Planner<State, Trajectory, System>
             
             // Compute the extension (checking for collision)
             Trajectory trajectory;
-            if (system->extendTo (*(vertexNew.state), *(vertexCurr.state), trajectory, exactConnection) <= 0 ) 
+            if (extendTo (*(vertexNew.state), *(vertexCurr.state), trajectory, exactConnection) <= 0 ) 
                 continue;
             
             // Insert the new trajectory to the tree by rewiring
             insertTrajectory (vertexNew, trajectory, vertexCurr);
+            statistics.numRewires++;
             
             // Update the cost of all vertices in the rewired branch
             updateBranchCost (vertexCurr, 0);
@@ -493,16 +624,12 @@ RRTstar::Planner<State, Trajectory, System>
 template<class State, class Trajectory, class System>
 int 
 RRTstar::Planner<State, Trajectory, System>
-::iteration () {
+::extendTree (State& stateRandom, bool goalTree, Vertex<State,Trajectory,System>*& vertexNewOut) {
     
     
-    // 1. Sample a new state
-    State stateRandom;
-    system->sampleState (stateRandom);    
-    
     // 2. Compute the set of all near vertices
     std::vector< Vertex<State,Trajectory,System>* > vectorNearVertices;
-    getNearVertices (stateRandom, vectorNearVertices);
+    getNearVertices (stateRandom, vectorNearVertices, goalTree);
     
     
     // 3. Find the best parent and extend from that parent
@@ -513,9 +640,9 @@ RRTstar::Planner<State, Trajectory, System>
     if (vectorNearVertices.size() == 0) {
         
         // 3.a Extend the nearest
-        if (getNearestVertex (stateRandom, vertexParent) <= 0) 
+        if (getNearestVertex (stateRandom, vertexParent, goalTree) <= 0) 
             return 0;
-        if (system->extendTo(vertexParent->getState(), stateRandom, trajectory, exactConnection) <= 0)
+        if (extendTo (vertexParent->getState(), stateRandom, trajectory, exactConnection) <= 0)
             return 0;
     }
     else {
@@ -535,6 +662,106 @@ RRTstar::Planner<State, Trajectory, System>
     if (vectorNearVertices.size() > 0) 
         rewireVertices (*vertexNew, vectorNearVertices);
     
+    vertexNewOut = vertexNew;
+    statistics.numExtensions++;
+    
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int 
+RRTstar::Planner<State, Trajectory, System>
+::connectTrees (Vertex<State,Trajectory,System>& vertexNew) {
+    
+    bool goalTree = !vertexNew.inGoalTree;
+    if ( (goalTree ? numVerticesGoal : numVertices) == 0)
+        return 0;
+    
+    // Collect the candidate vertices of the other tree
+    std::vector< Vertex<State,Trajectory,System>* > vectorNearVertices;
+    getNearVertices (vertexNew.getState(), vectorNearVertices, goalTree);
+    if (vectorNearVertices.size() == 0) {
+        Vertex<State,Trajectory,System>* vertexNearest = NULL;
+        if (getNearestVertex (vertexNew.getState(), vertexNearest, goalTree) <= 0)
+            return 0;
+        vectorNearVertices.push_back (vertexNearest);
+    }
+    
+    // Connect the cheapest collision-free vertex of the other tree to the new vertex
+    Vertex<State,Trajectory,System>* vertexOther = NULL;
+    Trajectory trajectory;
+    bool exactConnection = false;
+    if (findBestParent (vertexNew.getState(), vectorNearVertices, vertexOther, trajectory, exactConnection) <= 0)
+        return 0;
+    if (!exactConnection)
+        return 0;
+    
+    // Keep the bridge if it improves the best solution
+    Vertex<State,Trajectory,System>* vertexStart = vertexNew.inGoalTree ? vertexOther : &vertexNew;
+    Vertex<State,Trajectory,System>* vertexGoal = vertexNew.inGoalTree ? &vertexNew : vertexOther;
+    double costBridge = trajectory.evaluateCost();
+    if (vertexStart->costFromRoot + costBridge + vertexGoal->costFromRoot < evaluateBridgeCost ()) {
+        bridgeVertexStart = vertexStart;
+        bridgeVertexGoal = vertexGoal;
+        bridgeCost = costBridge;
+    }
+    
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+double 
+RRTstar::Planner<State, Trajectory, System>
+::evaluateBridgeCost () {
+    
+    if (bridgeVertexStart == NULL)
+        return DBL_MAX;
+    
+    // Rewiring may have lowered the costs on either side since the bridge was found
+    return bridgeVertexStart->costFromRoot + bridgeCost + bridgeVertexGoal->costFromRoot;
+}
+
+
+template<class State, class Trajectory, class System>
+int 
+RRTstar::Planner<State, Trajectory, System>
+::iteration () {
+    
+    
+    statistics.numIterations++;
+    
+    // Extend the start tree, or alternately the goal tree
+    bool goalTree = bidirectional && growGoalTree && (numVerticesGoal > 0);
+    growGoalTree = !growGoalTree;
+    
+    // 1. Sample a new state, every goalSampleInterval-th start tree sample is drawn from the goal region
+    State stateRandom;
+    if ( (!goalTree) && (goalSampleInterval > 0) && (++numStartTreeSamples % goalSampleInterval == 0) )
+        system->sampleGoalState (stateRandom);
+    else
+        system->sampleState (stateRandom);    
+    
+    // 2.-4. Extend the selected tree towards the sample
+    Vertex<State,Trajectory,System>* vertexNew = NULL;
+    if (extendTree (stateRandom, goalTree, vertexNew) <= 0)
+        return 0;
+    
+    
+    // 5. Try to connect the other tree to the new vertex
+    if (bidirectional) 
+        connectTrees (*vertexNew);
+    
+    
+    // Record the best cost whenever it improves
+    double costBest = getBestVertexCost ();
+    if ( (costBest < DBL_MAX) && 
+         (statistics.vectorBestCosts.empty() || (costBest < statistics.vectorBestCosts.back())) ) {
+        statistics.vectorBestCostIterations.push_back (statistics.numIterations);
+        statistics.vectorBestCosts.push_back (costBest);
+    }
+    
     
     return 1;
 }
@@ -545,61 +772,109 @@ int
 RRTstar::Planner<State, Trajectory, System>
 ::getBestTrajectory (std::list<double*>& trajectoryOut) {
     
+    // Follow the bridge between the two trees if it yields the cheaper solution
+    if (evaluateBridgeCost () < lowerBoundCost) 
+        return getBridgeTrajectory (trajectoryOut);
+    
     if (lowerBoundVertex == NULL){
     	std::cout<<"NULL-> getBestTrajectory "<<std::endl;
         return 0;
     }
-    Vertex<State,Trajectory,System>* vertexCurr = lowerBoundVertex;
     
+    return getTrajectoryFromRoot (*lowerBoundVertex, trajectoryOut);
+}
+
+
+template<class State, class Trajectory, class System>
+int 
+RRTstar::Planner<State, Trajectory, System>
+::getBridgeTrajectory (std::list<double*>& trajectoryOut) {
+    
+    // Start tree: from the root up to the start side of the bridge
+    getTrajectoryFromRoot (*bridgeVertexStart, trajectoryOut);
+    
+    // Bridge and goal tree: from the goal side of the bridge down to the goal state
+    std::list<double*> trajectoryBridge;
+    system->getTrajectory (bridgeVertexStart->getState(), bridgeVertexGoal->getState(), trajectoryBridge);
+    trajectoryOut.splice (trajectoryOut.end(), trajectoryBridge);
+    for (Vertex<State,Trajectory,System>* vertexCurr = bridgeVertexGoal; vertexCurr->parent; vertexCurr = vertexCurr->parent) {
+        std::list<double*> trajectory;
+        system->getTrajectory (vertexCurr->getState(), vertexCurr->parent->getState(), trajectory);
+        trajectoryOut.splice (trajectoryOut.end(), trajectory);
+    }
     
-    while (vertexCurr) {
-        
-        State& stateCurr = vertexCurr->getState();
-
-       // if (numDimensions==3)
-        //	double *stateArrCurr = new double[3];
-        // else
-        double *stateArrCurr = new double[numDimensions];
-//        for (int i=0;i<numDimensions;i++)
-//        	stateArrCurr[i] = stateCurr[i];
-       // stateArrCurr[1] = stateCurr[1];
-        
-//        trajectoryOut.push_front (stateArrCurr);
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int 
+RRTstar::Planner<State, Trajectory, System>
+::getTrajectoryFromRoot (Vertex<State,Trajectory,System>& vertexIn, std::list<double*>& trajectoryOut) {
+    
+    std::list<double*> trajectoryFromRoot;
+    for (Vertex<State,Trajectory,System>* vertexCurr = &vertexIn; vertexCurr->parent; vertexCurr = vertexCurr->parent) {
+        std::list<double*> trajectory;
+        system->getTrajectory (vertexCurr->parent->getState(), vertexCurr->getState(), trajectory);
+        trajectoryFromRoot.splice (trajectoryFromRoot.begin(), trajectory);
+    }
+    trajectoryOut.splice (trajectoryOut.end(), trajectoryFromRoot);
+    
+    return 1;
+}
+
+
+template<class State, class Trajectory, class System>
+int 
+RRTstar::Planner<State, Trajectory, System>
+::getBestTrajectoryToGoal (std::list<double*>& trajectoryOut) {
+    
+    State stateGoal;
+    if (system->getGoalState (stateGoal) <= 0) {
+        std::cout<<"Goal state in collision -> getBestTrajectoryToGoal "<<std::endl;
+        return 0;
+    }
+    
+    // Rank the goal region vertices by the cost of reaching the goal state through them
+    std::vector< std::pair<Vertex<State,Trajectory,System>*,double> > vectorVertexCostPairs;
+    for (typename std::vector< Vertex<State,Trajectory,System>* >::iterator iter = vectorGoalVertices.begin(); iter != vectorGoalVertices.end(); iter++) {
+        bool exactConnection = false;
+        double costToGoal = system->evaluateExtensionCost ( *((*iter)->state), stateGoal, exactConnection);
+        vectorVertexCostPairs.push_back (std::make_pair (*iter, (*iter)->costFromRoot + costToGoal));
+    }
+    std::sort (vectorVertexCostPairs.begin(), vectorVertexCostPairs.end(), compareVertexCostPairs<State,Trajectory,System>);
+    
+    // The bridge of the bidirectional mode already ends at the goal state
+    double costBridge = evaluateBridgeCost ();
+    
+    // Collision check the final connections, cheapest first
+    Vertex<State,Trajectory,System>* vertexBest = NULL;
+    for (typename std::vector< std::pair<Vertex<State,Trajectory,System>*,double> >::iterator iter = vectorVertexCostPairs.begin(); 
+         iter != vectorVertexCostPairs.end(); iter++) {
         
-        Vertex<State,Trajectory,System>& vertexParent = vertexCurr->getParent(); 
+        if (iter->second >= costBridge)
+            break;
         
-        if (&vertexParent != NULL) {
-            
-            State& stateParent = vertexParent.getState();
-            
-            std::list<double*> trajectory;
-            system->getTrajectory (stateParent, stateCurr, trajectory);
-            
-            trajectory.reverse ();
-//            std::cout<<"trajectory.size(): "<<trajectory.size()<<std::endl;
-
-            for (std::list<double*>::iterator iter = trajectory.begin(); iter != trajectory.end(); iter++) {
-                
-                double *stateArrFromParentCurr = *iter;
-                
-             /*   stateArrCurr = new double[2];
-                stateArrCurr[0] = stateArrFromParentCurr[0];
-                stateArrCurr[1] = stateArrFromParentCurr[1];
-              */
-                stateArrCurr = new double[numDimensions];
-                for (int i=0;i<numDimensions;i++)
-                	stateArrCurr[i] = stateArrFromParentCurr[i];
-               // stateArrCurr[1] = stateArrFromParentCurr[1];
-
-                trajectoryOut.push_front (stateArrCurr);
-                
-                delete [] stateArrFromParentCurr;
-            }
+        Trajectory trajectory;
+        bool exactConnection = false;
+        if ( (extendTo (*(iter->first->state), stateGoal, trajectory, exactConnection) > 0) && exactConnection ) {
+            vertexBest = iter->first;
+            break;
         }
-        
-        vertexCurr = &vertexParent;
     }
     
+    if (vertexBest == NULL) {
+        if (costBridge < DBL_MAX)
+            return getBridgeTrajectory (trajectoryOut);
+        std::cout<<"NULL-> getBestTrajectoryToGoal "<<std::endl;
+        return 0;
+    }
+    
+    getTrajectoryFromRoot (*vertexBest, trajectoryOut);
+    std::list<double*> trajectoryToGoal;
+    system->getTrajectory (vertexBest->getState(), stateGoal, trajectoryToGoal);
+    trajectoryOut.splice (trajectoryOut.end(), trajectoryToGoal);
+    
     return 1;
 }
 
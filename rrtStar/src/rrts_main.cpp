@@ -11,13 +11,22 @@
 #include <vector>
 #include <rrtstar_msgs/rrtStarSRV.h>
 #include <rrtstar_msgs/Region.h>
+#include <rrtstar_msgs/PlannerStatistics.h>
 #include <geometry_msgs/Vector3.h>
 #include <time.h>
+#include <mutex>
+#include <dynamic_reconfigure/server.h>
+#include <rrtstar/PlannerConfig.h>
 
 #include "rrts.hpp"
+#include "fmts.hpp"
 #include "system_single_integrator.h"
+#include "alloc_tracker.h"
+#include "rrtstar/rrtstar_node.h"
 
 
+namespace rrtstar_node {
+
 using namespace RRTstar;
 using namespace SingleIntegrator;
 
@@ -27,11 +36,140 @@ using namespace std;
 
 typedef Planner<State,Trajectory,System> planner_t;
 typedef Vertex<State,Trajectory,System> vertex_t;
+typedef FMTstar::Planner<State,Trajectory,System> fmts_t;
+
+bool bidirectional = false; // Grow a second tree from the goal (RRT*-Connect)
+bool batch = false; // Plan with FMT* on a batch of samples instead of RRT*
+int batchSamples = 3000; // States sampled by FMT* per request
+double cacheQuantum = 5.0; // Cell size of the collision cache keys (cm)
+CollisionCache* collisionCache = NULL; // Collision checks, across requests
+int goalSampleInterval = 20; // Draw every n-th sample from the goal region
+int statisticsInterval = 5000; // Publish the planner statistics every n iterations
+int NoIteration = 40000; // Planner iterations per request
+double gamaValue = 1.5; // RRT* rewiring constant
+int prewarmIterations = 2000; // Iterations of the warm-up plan run at startup
+double prewarmWidth = 400, prewarmHeight = 400; // Workspace of the warm-up plan (cm)
+ros::Publisher statisticsPub;
+ros::ServiceServer service;
+std::mutex configMutex; // Reconfiguration vs. requests in progress
+dynamic_reconfigure::Server<rrtstar::PlannerConfig>* configServer;
+
+template<class Planner_t>
+int publish_Tree_Regions (string time_start, Planner_t& planner, System& system);
+int publishTraj (string time_start, list<double*>& stateList, System& system, State &, float* goalCenter);
+
+/*!
+ * Copies the planner counters into a statistics message (RRT* or FMT*).
+ */
+template<class Planner_t>
+void fillStatistics (Planner_t& planner, double planningTime, rrtstar_msgs::PlannerStatistics& msg) {
+
+	const Statistics& statistics = planner.getStatistics ();
+
+	msg.iterations = statistics.numIterations;
+	msg.extensions = statistics.numExtensions;
+	msg.collision_checks = statistics.numCollisionChecks;
+	msg.nn_queries = statistics.numNearestQueries;
+	msg.rewires = statistics.numRewires;
+	msg.tree_size = planner.numVertices + planner.numVerticesGoal;
+	msg.goal_vertices = planner.getNumGoalVertices ();
+	msg.planning_time = planningTime;
+	msg.best_cost = (planner.getBestVertexCost () < DBL_MAX) ? planner.getBestVertexCost () : -1.0;
+	msg.best_cost_iterations.assign (statistics.vectorBestCostIterations.begin(), statistics.vectorBestCostIterations.end());
+	msg.best_costs = statistics.vectorBestCosts;
+}
 
-int publish_Tree_Regions (string time_start, planner_t& planner, System& system);
-int publishTraj (string time_start, planner_t& planner, System& system, State &, float* goalCenter);
+/*!
+ * Reports the outcome of a plan (RRT* or FMT*): prints and fills the
+ * statistics, returns the path to the goal and, if publish is set, logs the
+ * tree and the trajectory.
+ */
+template<class Planner_t>
+bool reportPath (Planner_t& planner, System& system, State& rootState, float* goalCenter,
+                 clock_t start, clock_t finish, bool publish, rrtstar_msgs::rrtStarSRV::Response &res) {
 
-bool generatePath(rrtstar_msgs::rrtStarSRV::Request &req, rrtstar_msgs::rrtStarSRV::Response &res){
+    //variables:
+    geometry_msgs::Vector3 pathState;
+
+    cout << "Time : " << ((double)(finish-start))/CLOCKS_PER_SEC << endl;
+
+    fillStatistics (planner, ((double)(finish-start))/CLOCKS_PER_SEC, res.statistics);
+    if (publish)
+        statisticsPub.publish (res.statistics);
+    cout << "Statistics : " << res.statistics.iterations << " iterations, "
+         << res.statistics.extensions << " extensions, "
+         << res.statistics.collision_checks << " collision checks, "
+         << res.statistics.nn_queries << " NN queries, "
+         << res.statistics.rewires << " rewires, "
+         << res.statistics.tree_size << " vertices, best cost "
+         << res.statistics.best_cost << endl;
+    if (system.numCacheHits + system.numCacheMisses > 0)
+        cout << "Collision cache : " << system.numCacheHits << " hits, "
+             << system.numCacheMisses << " misses" << endl;
+
+	list<double*> stateList;
+    planner.getBestTrajectoryToGoal (stateList);
+    cout<<"stateList.size(): "<<stateList.size()<<endl;
+
+    //! add init state to returning path, only if the goal was reached
+    if (stateList.size()>0){
+        pathState.x=rootState[0] ;
+        pathState.y=rootState[1];
+        if (system.getNumDimensions() > 2)
+        	pathState.z=rootState[2];
+        else
+        	pathState.z=0.0;
+        res.path.push_back(pathState);
+    }
+
+    //! if a path based on rrtstar found, add it to returning path (it ends at the goal state):
+
+    for (list<double*>::iterator iter = stateList.begin(); iter != stateList.end(); iter++) {
+        double* TrajState = *iter;
+        pathState.x=TrajState[0];
+        pathState.y=TrajState[1];
+
+        if (system.getNumDimensions() > 2)
+        	pathState.z=TrajState[2];
+        else
+        	pathState.z=0.0;
+        res.path.push_back(pathState);
+    }
+
+
+//    for (int i=0;i<stateList.size();i++){
+//		cout<<"pitt_call.objectFeature["<<i<<"][0]: "<<pitt_call.objectFeature[i][0]<<" "<<pitt_call.objectFeature[i][1]<<endl;
+//		obstacle.center_x=pitt_call.objectFeature[i][0];
+//		obstacle.center_y=pitt_call.objectFeature[i][1];
+//		obstacle.center_z=pitt_call.objectFeature[i][2];
+//		obstacle.size_x=pitt_call.objectFeature[i][3];
+//		obstacle.size_y=pitt_call.objectFeature[i][4];
+//		obstacle.size_z=pitt_call.objectFeature[i][5];
+//		res..push_back(obstacle);
+//	}
+	char stringTime[20];
+
+	sprintf(stringTime, "%d", ((double)(start))/CLOCKS_PER_SEC);
+
+    if (publish) {
+        publish_Tree_Regions(stringTime,planner, system);
+        publishTraj (stringTime,stateList, system,rootState, goalCenter);
+    }
+
+    for (list<double*>::iterator iter = stateList.begin(); iter != stateList.end(); iter++)
+        delete [] *iter;
+
+     return true;
+}
+
+/*!
+ * Plans a path for one request.
+ *
+ * Runs the given number of iterations; the statistics and the tree are
+ * published only if publish is set (not for the warm-up plan).
+ */
+bool planPath(rrtstar_msgs::rrtStarSRV::Request &req, rrtstar_msgs::rrtStarSRV::Response &res,
+              int numIterations, bool publish){
 //! request Values:
 
 	cout<<"**********"<<endl;
@@ -65,14 +203,19 @@ bool generatePath(rrtstar_msgs::rrtStarSRV::Request &req, rrtstar_msgs::rrtStarS
     }
 //! rrtStar Method:
 
-    planner_t rrts;
     // Create the dynamical system
     System system;
 
-    //variables:
-    float gamaValue=1.5;
-    int NoIteration=40000;
-    geometry_msgs::Vector3 pathState;
+    // Settings of this request, reconfigured ones apply to the next
+    std::unique_lock<std::mutex> configLock(configMutex);
+    bool bidirectionalIn = bidirectional;
+    int goalSampleIntervalIn = goalSampleInterval;
+    int statisticsIntervalIn = statisticsInterval;
+    float gamaValueIn = gamaValue;
+    bool batchIn = batch;
+    int batchSamplesIn = batchSamples;
+    double cacheQuantumIn = cacheQuantum;
+    configLock.unlock();
 
       // Three dimensional configuration space
     system.setNumDimensions (2);
@@ -95,27 +238,21 @@ bool generatePath(rrtstar_msgs::rrtStarSRV::Request &req, rrtstar_msgs::rrtStarS
     system.regionGoal.size[1] = req.Goal.size_y;;
     //system.regionGoal.size[2] = req.Goal.size_z;
 
+    // The goal state, where the path ends, if not the center of the region
+    if (req.GoalState.size() == 1) {
+        double goalState[2] = {req.GoalState[0].x, req.GoalState[0].y};
+        system.setGoalState (goalState);
+        cout<<"GoalState: "<<goalState[0]<<" "<<goalState[1]<<endl;
+    }
+
     float goalCenter[2];
-    goalCenter[0]=system.regionGoal.center[0];
-    goalCenter[1]=system.regionGoal.center[1];
+    goalCenter[0]=req.GoalState.size() == 1 ? req.GoalState[0].x : system.regionGoal.center[0];
+    goalCenter[1]=req.GoalState.size() == 1 ? req.GoalState[0].y : system.regionGoal.center[1];
     //goalCenter[2]=system.regionGoal.center[2];
 
 
-  	// Setup the root vertex
-
-      // Add the system to the planner
-    rrts.setSystem (system);
-
-      // Set up the root vertex
-    vertex_t &root = rrts.getRootVertex();
-    State &rootState = root.getState();
-    rootState[0] = req.Init.x;
-    rootState[1] = req.Init.y;
-   // rootState[2] = req.Init.z;
-
-    // Define the obstacle region
-    if (system.obstacles.size()>0)
-    	system.obstacles.clear();
+    // Define the obstacle region (the system owns and deletes the obstacles)
+    system.clearObstacles();
 
 	for (int i=0; i< req.Obstacles.size(); ++i){
 		const rrtstar_msgs::Region &obs = req.Obstacles[i];
@@ -132,102 +269,194 @@ bool generatePath(rrtstar_msgs::rrtStarSRV::Request &req, rrtstar_msgs::rrtStarS
 	}
 
 
+    // Cost map: edges cost their length weighted by the cells they cross
+    if ( (req.CostCols > 0) && (req.CostMap.size() > 0) && (req.CostMap.size() % req.CostCols == 0) ) {
+        system.setCostMap (req.CostCols, req.CostMap.size()/req.CostCols, &req.CostMap[0]);
+        cout << "Cost map: " << req.CostCols << "x" << req.CostMap.size()/req.CostCols << endl;
+    }
+
+    // Collision checks cached across requests, keyed by this obstacle set
+    if ( collisionCache && (cacheQuantumIn > 0.0) )
+        system.setCollisionCache (collisionCache, cacheQuantumIn);
+
+    // FMT*: one batch of samples, marched once
+    if (batchIn) {
+        fmts_t fmts;
+        fmts.setSystem (system);
+        State &rootState = fmts.getRootVertex().getState();
+        rootState[0] = req.Init.x;
+        rootState[1] = req.Init.y;
+
+        fmts.setGamma (gamaValueIn);
+        fmts.setNumSamples (batchSamplesIn);
+        fmts.setGoalSampleInterval (goalSampleIntervalIn);
+
+        clock_t start = clock();
+        fmts.initialize ();
+        if (fmts.run () <= 0)
+            cout << "FMT* : the goal is not reachable through the batch" << endl;
+        clock_t finish = clock();
+
+        return reportPath (fmts, system, rootState, goalCenter, start, finish, publish, res);
+    }
+
+  	// Setup the root vertex
+
+      // Add the system to the planner
+    planner_t rrts;
+    rrts.setSystem (system);
+
+      // Set up the root vertex
+    vertex_t &root = rrts.getRootVertex();
+    State &rootState = root.getState();
+    rootState[0] = req.Init.x;
+    rootState[1] = req.Init.y;
+   // rootState[2] = req.Init.z;
+
       // Initialize the planner
+    rrts.setBidirectional (bidirectionalIn);
+    rrts.setGoalSampleInterval (goalSampleIntervalIn);
     rrts.initialize ();
 
       // This parameter should be larger than 1.5 for asymptotic
       //   rather than exploration in the RRT* algorithm. Lower
       //   optimality. Larger values will weigh on optimization
       //   values, such as 0.1, should recover the RRT.
-    rrts.setGamma (gamaValue);
+    rrts.setGamma (gamaValueIn);
 
     clock_t start = clock();
     // Run the algorithm for 10000 iteartions
-	for (int i = 0; i < NoIteration; i++)
+	for (int i = 0; i < numIterations; i++) {
     	rrts.iteration ();
+
+    	// Periodic diagnostics while planning
+    	if ( publish && (statisticsIntervalIn > 0) && ((i+1) % statisticsIntervalIn == 0) ) {
+    		fillStatistics (rrts, ((double)(clock()-start))/CLOCKS_PER_SEC, res.statistics);
+    		statisticsPub.publish (res.statistics);
+    	}
+    }
     clock_t finish = clock();
 
-    cout << "Time : " << ((double)(finish-start))/CLOCKS_PER_SEC << endl;
+    return reportPath (rrts, system, rootState, goalCenter, start, finish, publish, res);
+  }
 
-	list<double*> stateList;
-    rrts.getBestTrajectory (stateList);
-    cout<<"stateList.size(): "<<stateList.size()<<endl;
+bool generatePath(rrtstar_msgs::rrtStarSRV::Request &req, rrtstar_msgs::rrtStarSRV::Response &res){
 
-    //! add init state to returning path
-//    if (stateList.size()>0){
-        pathState.x=rootState[0] ;
-        pathState.y=rootState[1];
-        if (system.getNumDimensions() > 2)
-        	pathState.z=rootState[2];
-        else
-        	pathState.z=0.0;
-        res.path.push_back(pathState);
-//    }
+	long bytesBefore = AllocTracker::getBytesLive();
+	long allocationsBefore = AllocTracker::getNumAllocations();
 
-    //! if a path based on rrtstar found, add it to returning path:
+	configMutex.lock();
+	int numIterations = NoIteration;
+	configMutex.unlock();
 
-    for (list<double*>::iterator iter = stateList.begin(); iter != stateList.end(); iter++) {
-        double* TrajState = *iter;
-        pathState.x=TrajState[0];
-        pathState.y=TrajState[1];
+	// The planner and the system are released when planPath returns
+	bool result = planPath(req, res, numIterations, true);
 
-        if (system.getNumDimensions() > 2)
-        	pathState.z=TrajState[2];
-        else
-        	pathState.z=0.0;
-        delete [] TrajState;
-        res.path.push_back(pathState);
-    }
+	//! report the heap still held after the request, the response included
+	if (AllocTracker::isEnabled())
+		cout << "Memory : " << bytesBefore << " bytes live before, "
+		     << AllocTracker::getBytesLive() << " after ("
+		     << AllocTracker::getBlocksLive() << " blocks, "
+		     << AllocTracker::getNumAllocations() - allocationsBefore << " allocations)" << endl;
 
-    //! add final goal to the found path:
-	pathState.x=goalCenter[0];
-	pathState.y=goalCenter[1];
-	if (system.getNumDimensions() > 2)
-		pathState.z=goalCenter[2];
-	else
-		pathState.z=0.0;
-	res.path.push_back(pathState);
+	return result;
+}
 
 
-//    for (int i=0;i<stateList.size();i++){
-//		cout<<"pitt_call.objectFeature["<<i<<"][0]: "<<pitt_call.objectFeature[i][0]<<" "<<pitt_call.objectFeature[i][1]<<endl;
-//		obstacle.center_x=pitt_call.objectFeature[i][0];
-//		obstacle.center_y=pitt_call.objectFeature[i][1];
-//		obstacle.center_z=pitt_call.objectFeature[i][2];
-//		obstacle.size_x=pitt_call.objectFeature[i][3];
-//		obstacle.size_y=pitt_call.objectFeature[i][4];
-//		obstacle.size_z=pitt_call.objectFeature[i][5];
-//		res..push_back(obstacle);
-//	}
-	char stringTime[20];
 
-	sprintf(stringTime, "%d", ((double)(start))/CLOCKS_PER_SEC);
+/*!
+ * Reconfiguration callback: takes the new planner settings, used from the
+ * next request on (a request in progress keeps its own).
+ */
+void reconfigure (rrtstar::PlannerConfig& config, uint32_t level) {
+
+	std::lock_guard<std::mutex> lock(configMutex);
+	gamaValue = config.gamma;
+	NoIteration = config.iterations;
+	goalSampleInterval = config.goal_sample_interval;
+	statisticsInterval = config.statistics_interval;
+	bidirectional = config.bidirectional;
+	batch = config.batch;
+	batchSamples = config.samples;
+	cacheQuantum = config.cache_quantum;
+	cout << "Reconfigured: gamma " << gamaValue << ", " << NoIteration
+	     << " iterations" << (bidirectional ? ", bidirectional" : "");
+	if (batch)
+		cout << ", FMT* on " << batchSamples << " samples";
+	cout << endl;
+}
 
-    publish_Tree_Regions(stringTime,rrts, system);
-    publishTraj (stringTime,rrts, system,rootState, goalCenter);
 
-     return true;
-  }
 
+/*!
+ * Plans once on a synthetic request (free workspace of the size given by
+ * workspace/width and workspace/height, corner to corner) before the
+ * service is advertised, so that the code, the heap and the kd-tree
+ * allocations are warm for the first real request.
+ */
+void prewarm () {
 
+	rrtstar_msgs::rrtStarSRV::Request req;
+	rrtstar_msgs::rrtStarSRV::Response res;
 
-int main (int argc, char** argv) {
+	req.WS.size_x = prewarmWidth;
+	req.WS.size_y = prewarmHeight;
+	req.Goal.center_x = 3*prewarmWidth/8;
+	req.Goal.center_y = 3*prewarmHeight/8;
+	req.Goal.size_x = 20;
+	req.Goal.size_y = 20;
+	req.Init.x = -3*prewarmWidth/8;
+	req.Init.y = -3*prewarmHeight/8;
+
+	ros::WallTime start = ros::WallTime::now();
+	planPath(req, res, prewarmIterations, false);
+	cout << "Prewarmed in " << (ros::WallTime::now()-start).toSec() << " s" << endl;
+}
+
+/*!
+ * Reads the parameters from the private handle pn, prewarms the planner and
+ * advertises the service on n. The planner settings (gamma, iterations,
+ * goal_sample_interval, statistics_interval, bidirectional, batch, samples,
+ * cache_quantum) are served by dynamic_reconfigure under pn. The service is
+ * served by whoever spins the callback queue of n.
+ *
+ * Collision checks are cached across requests in a table of
+ * ~collision_cache entries (0 for none), which is shared, without locks, by
+ * the requests served concurrently.
+ */
+void setup (ros::NodeHandle& n, ros::NodeHandle& pn) {
 	// IMPORTANT:
 
 	// 1- define safety factor of the obstacles here;
 
-	ros::init(argc, argv, "rrtstar");
-	ros::NodeHandle nh;
-	ros::ServiceServer service = nh.advertiseService("rrtStarService",generatePath);
+	pn.param("prewarm_iterations", prewarmIterations, 2000);
+	int cacheSlots;
+	pn.param("collision_cache", cacheSlots, 262144);
+	if (cacheSlots > 0)
+		collisionCache = new CollisionCache (cacheSlots);
+	n.param("workspace/width", prewarmWidth, 400.0);
+	n.param("workspace/height", prewarmHeight, 400.0);
+	statisticsPub = n.advertise<rrtstar_msgs::PlannerStatistics>("rrtStarStatistics", 10);
+
+	// Initial settings from the parameters (or the defaults), then live
+	configServer = new dynamic_reconfigure::Server<rrtstar::PlannerConfig>(pn);
+	configServer->setCallback(reconfigure);
+
+	if (prewarmIterations > 0)
+		prewarm();
+
+	// Advertising the service signals that the planner is ready
+	service = n.advertiseService("rrtStarService",generatePath);
 
     cout << "*****************" << endl;
     cout << "RRTstar is alive: " << endl;
-
-    ros::spin();
-    return 1;
+    if (batch)
+        cout << "FMT* batch mode" << endl;
+    else if (bidirectional)
+        cout << "Bidirectional mode" << endl;
 }
 
-int publishTraj ( string stringTime,planner_t& planner, System& system,State & initState, float * goalCenter) {
+int publishTraj ( string stringTime,list<double*>& stateList, System& system,State & initState, float * goalCenter) {
 
 	const char* DataLogPath	="/home/nasa/Datalog/rrtStar";
 	string DataLogPath2		="/home/nasa/Datalog/rrtStar";
@@ -239,19 +468,12 @@ int publishTraj ( string stringTime,planner_t& planner, System& system,State & i
 
     cout << "Publishing trajectory -- start" << endl;
 
-    vertex_t& vertexBest = planner.getBestVertex ();
-
-    //cout<<"planner.getBestVertexCost(): "<<planner.getBestVertexCost()<<endl;
-
-    if (&vertexBest == NULL) {
-        cout << "No best vertex" << endl;
+    // The path to the goal, as returned (empty if none was found)
+    if (stateList.empty()) {
+        cout << "No collision-free connection to the goal" << endl;
         return 0;
     }
 
-    list<double*> stateList;
-    planner.getBestTrajectory (stateList);
-    cout<<"stateList.size(): "<<stateList.size()<<endl;
-
     //! insert initial state to the response path:
 //    if (stateList.size()>0){
 	Myfile1 <<initState[0]<<" "<<initState[1]<<" ";
@@ -276,24 +498,17 @@ int publishTraj ( string stringTime,planner_t& planner, System& system,State & i
            	cout<<0.0<<"\n";
            Myfile1 <<0.0<<"\n";
         }
-        delete [] stateRef;
 
         stateIndex++;
     }
 
-    //! insert final state to the response path:
-	Myfile1 <<goalCenter[0]<<" "<<goalCenter[1]<<" ";
-	if (system.getNumDimensions() > 2)
-		Myfile1 <<goalCenter[2]<<"\n";
-	else
-		Myfile1 <<0.0<<"\n";
-
     Myfile1.close();
     cout << "Publishing trajectory -- end" << endl;
     return 1;
 }
 
-int publish_Tree_Regions (string stringTime,planner_t& planner, System& system) {
+template<class Planner_t>
+int publish_Tree_Regions (string stringTime,Planner_t& planner, System& system) {
 
 	const char* DataLogPath	="/home/nasa/Datalog/rrtStar";
 	string DataLogPath2		="/home/nasa/Datalog/rrtStar";
@@ -417,3 +632,17 @@ int publish_Tree_Regions (string stringTime,planner_t& planner, System& system)
 
     return 1;
 }
+
+} // namespace rrtstar_node
+
+#ifndef RRTSTAR_COMPONENT
+int main (int argc, char** argv) {
+
+	ros::init(argc, argv, "rrtstar");
+	ros::NodeHandle nh, pnh("~");
+	rrtstar_node::setup(nh, pnh);
+
+    ros::spin();
+    return 1;
+}
+#endif
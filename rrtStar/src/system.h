@@ -55,6 +55,14 @@ public:
      */
     Trajectory& operator= (const Trajectory &trajectoryIn);
     
+    /*!
+     * \brief Trajectory move assignment operator.
+     *
+     * Used by the planner to hand a trajectory over to the tree without
+     * copying it.
+     */
+    Trajectory& operator= (Trajectory &&trajectoryIn);
+    
     /*!
      * \brief Returns a reference to the end state of this trajectory.
      *
@@ -120,6 +128,28 @@ public:
      */
     bool isReachingTarget (State& stateIn);
     
+    /*!
+     * \brief Returns the goal state, i.e., the root of the goal tree.
+     *
+     * Used by the bidirectional planner. Returns zero if the goal state
+     * is in collision.
+     *
+     * \param goalStateOut
+     *
+     */
+    int getGoalState (State& goalStateOut);
+    
+    /*!
+     * \brief Returns a sample state from the goal region.
+     *
+     * Used by the planner to inject goal samples. Returns zero if the 
+     * sample is in collision.
+     *
+     * \param randomStateOut
+     *
+     */
+    int sampleGoalState (State& randomStateOut);
+    
     /*!
      * \brief Returns a sample state.
      *
@@ -1,8 +1,12 @@
 #include "system_single_integrator.h"
+#include <cfloat>
 #include <cmath>
 #include <cstdlib>
 
+#include <algorithm>
 #include <iostream>
+#include <utility>
+#include <vector>
 
 using namespace std;
 using namespace SingleIntegrator;
@@ -85,6 +89,7 @@ State& State::operator=(const State &stateIn){
     if (numDimensions != stateIn.numDimensions) {
         if (x) 
             delete [] x;
+        x = NULL;
         numDimensions = stateIn.numDimensions;
         if (numDimensions > 0)
             x = new double[numDimensions];
@@ -99,11 +104,12 @@ State& State::operator=(const State &stateIn){
 
 int State::setNumDimensions (int numDimensionsIn) {
     
+    if (numDimensionsIn < 0)
+        return 0;
+    
     if (x)
         delete [] x;
-    
-    if (numDimensions < 0)
-        return 0;
+    x = NULL;
     
     numDimensions = numDimensionsIn;
     
@@ -117,6 +123,7 @@ int State::setNumDimensions (int numDimensionsIn) {
 Trajectory::Trajectory () {
     
     endState = NULL;
+    totalVariation = 0.0;
 }
 
 
@@ -130,7 +137,27 @@ Trajectory::~Trajectory () {
 Trajectory::Trajectory (const Trajectory &trajectoryIn) {
     
     endState = new State (trajectoryIn.getEndState()); 
+    
+    totalVariation = trajectoryIn.totalVariation;
+}
 
+
+Trajectory::Trajectory (Trajectory &&trajectoryIn) {
+    
+    endState = trajectoryIn.endState;
+    trajectoryIn.endState = NULL;
+    
+    totalVariation = trajectoryIn.totalVariation;
+}
+
+
+Trajectory& Trajectory::operator=(Trajectory &&trajectoryIn) {
+    
+    std::swap (endState, trajectoryIn.endState);
+    
+    totalVariation = trajectoryIn.totalVariation;
+    
+    return *this;
 }
 
 
@@ -160,11 +187,31 @@ double Trajectory::evaluateCost () {
 System::System () {
     
     numDimensions = 0;
+    
+    costCols = 0;
+    costRows = 0;
+    
+    collisionCache = NULL;
+    cacheQuantum = 0.0;
+    cacheVersion = 0;
+    numCacheHits = 0;
+    numCacheMisses = 0;
 }
 
 
 System::~System () {
     
+    clearObstacles ();
+}
+
+
+int System::clearObstacles () {
+    
+    for (list<region*>::iterator iter = obstacles.begin(); iter != obstacles.end(); iter++)
+        delete *iter;
+    obstacles.clear();
+    
+    return 1;
 }
 
 
@@ -181,6 +228,97 @@ int System::setNumDimensions (int numDimensionsIn) {
 }
 
 
+int System::setCostMap (int colsIn, int rowsIn, const double *costsIn) {
+    
+    if ( (colsIn <= 0) || (rowsIn <= 0) ) {
+        costCols = 0;
+        costRows = 0;
+        cellCosts.clear();
+        return 1;
+    }
+    
+    if (numDimensions < 2)
+        return 0;
+    
+    costCols = colsIn;
+    costRows = rowsIn;
+    cellCosts.resize (costCols*costRows);
+    for (int c = 0; c < costCols*costRows; c++)
+        cellCosts[c] = (costsIn[c] > 0.0) ? costsIn[c] : 0.0;
+    
+    return 1;
+}
+
+
+double System::evaluateSegmentCost (double *stateFromIn, double *stateToIn, double distIn) {
+    
+    if (costCols == 0)
+        return distIn;
+    
+    // Segment in cell units, from the corner of the operating region
+    double cellWidth = regionOperating.size[0]/costCols;
+    double cellHeight = regionOperating.size[1]/costRows;
+    double x0 = (stateFromIn[0] - regionOperating.center[0])/cellWidth + costCols/2.0;
+    double y0 = (stateFromIn[1] - regionOperating.center[1])/cellHeight + costRows/2.0;
+    double dx = (stateToIn[0] - regionOperating.center[0])/cellWidth + costCols/2.0 - x0;
+    double dy = (stateToIn[1] - regionOperating.center[1])/cellHeight + costRows/2.0 - y0;
+    
+    // DDA walk: visit the cells crossed in order, each for the fraction
+    // of the segment inside it
+    int i = (int)floor (x0);
+    int j = (int)floor (y0);
+    int stepI = (dx > 0.0) ? 1 : -1;
+    int stepJ = (dy > 0.0) ? 1 : -1;
+    double tDeltaX = (dx != 0.0) ? fabs (1.0/dx) : DBL_MAX;
+    double tDeltaY = (dy != 0.0) ? fabs (1.0/dy) : DBL_MAX;
+    double tMaxX = (dx > 0.0) ? (i + 1 - x0)/dx : (dx < 0.0) ? (x0 - i)/(-dx) : DBL_MAX;
+    double tMaxY = (dy > 0.0) ? (j + 1 - y0)/dy : (dy < 0.0) ? (y0 - j)/(-dy) : DBL_MAX;
+    int numCells = abs ((int)floor (x0 + dx) - i) + abs ((int)floor (y0 + dy) - j) + 1;
+    
+    double t = 0.0;
+    double costExtra = 0.0;
+    for (int n = 0; n < numCells; n++) {
+        double tNext = (n == numCells - 1) ? 1.0 : fmin (1.0, fmin (tMaxX, tMaxY));
+        int iCell = (i < 0) ? 0 : (i >= costCols) ? costCols - 1 : i;
+        int jCell = (j < 0) ? 0 : (j >= costRows) ? costRows - 1 : j;
+        costExtra += cellCosts[iCell + costCols*jCell]*(tNext - t);
+        if (tNext >= 1.0)
+            break;
+        t = tNext;
+        if (tMaxX < tMaxY) {
+            i += stepI;
+            tMaxX += tDeltaX;
+        }
+        else {
+            j += stepJ;
+            tMaxY += tDeltaY;
+        }
+    }
+    
+    return distIn*(1.0 + costExtra);
+}
+
+
+int System::setCollisionCache (CollisionCache *cacheIn, double quantumIn) {
+    
+    if ( (cacheIn != NULL) && (quantumIn <= 0.0) )
+        return 0;
+    
+    collisionCache = cacheIn;
+    cacheQuantum = quantumIn;
+    
+    // The version of the obstacle set: a hash of the obstacles and the quantum
+    cacheVersion = CollisionCache::hash (numDimensions, llround (quantumIn*1e6));
+    for (list<region*>::iterator iter = obstacles.begin(); iter != obstacles.end(); iter++)
+        for (int i = 0; i < numDimensions; i++) {
+            cacheVersion = CollisionCache::hash (cacheVersion, llround ((*iter)->center[i]*1e6));
+            cacheVersion = CollisionCache::hash (cacheVersion, llround ((*iter)->size[i]*1e6));
+        }
+    
+    return 1;
+}
+
+
 int System::getStateKey (State& stateIn, double* stateKey) {
     
     for (int i = 0; i < numDimensions; i++) 
@@ -204,6 +342,28 @@ bool System::isReachingTarget (State &stateIn) {
 }
 
 
+int System::setGoalState (double *stateIn) {
+    
+    goalState.assign (stateIn, stateIn + numDimensions);
+    
+    return 1;
+}
+
+
+int System::getGoalState (State &goalStateOut) {
+    
+    goalStateOut.setNumDimensions (numDimensions);
+    
+    for (int i = 0; i < numDimensions; i++) 
+        goalStateOut.x[i] = goalState.empty() ? regionGoal.center[i] : goalState[i];
+    
+    if (IsInCollision (goalStateOut.x))
+        return 0;
+    
+    return 1;
+}
+
+
 bool System::IsInCollision (double *stateIn) {
     
     for (list<region*>::iterator iter = obstacles.begin(); iter != obstacles.end(); iter++) {
@@ -226,6 +386,102 @@ bool System::IsInCollision (double *stateIn) {
 } 
 
 
+double System::getObstacleDepth (double *stateIn, double depthMaxIn) {
+    
+    // Distance to the nearest obstacle along the farthest axis, negative
+    // inside; obstacles farther than depthMaxIn are skipped
+    double depth = depthMaxIn;
+    for (list<region*>::iterator iter = obstacles.begin(); iter != obstacles.end(); iter++) {
+        
+        region *obstacleCurr = *iter;
+        double depthCurr = -DBL_MAX;
+        
+        for (int i = 0; i < numDimensions; i++) {
+            double depthAxis = fabs(obstacleCurr->center[i] - stateIn[i]) - obstacleCurr->size[i]/2.0;
+            if (depthAxis > depthCurr)
+                depthCurr = depthAxis;
+            if (depthCurr > depth)
+                break;
+        }
+        
+        if (depthCurr < depth)
+            depth = depthCurr;
+    }
+    
+    return depth;
+}
+
+
+unsigned long long System::getSegmentKey (double *stateFromIn, double *stateToIn) {
+    
+    vector<long long> cells (2*numDimensions);
+    for (int i = 0; i < numDimensions; i++) {
+        cells[i] = (long long)floor (stateFromIn[i]/cacheQuantum);
+        cells[numDimensions + i] = (long long)floor (stateToIn[i]/cacheQuantum);
+    }
+    
+    // Both directions share the key
+    if (lexicographical_compare (cells.begin() + numDimensions, cells.end(), cells.begin(), cells.begin() + numDimensions))
+        swap_ranges (cells.begin(), cells.begin() + numDimensions, cells.begin() + numDimensions);
+    
+    unsigned long long key = cacheVersion;
+    for (int i = 0; i < 2*numDimensions; i++)
+        key = CollisionCache::hash (key, cells[i]);
+    
+    return key;
+}
+
+
+bool System::isSegmentFree (double *stateFromIn, double *stateToIn, double distIn, unsigned long long keyIn) {
+    
+    double incrementTotal = distIn/DISCRETIZATION_STEP;
+    int numSegments = (int)floor(incrementTotal);
+    
+    // normalize the distance according to the disretization step
+    vector<double> dists (numDimensions);
+    for (int i = 0; i < numDimensions; i++)
+        dists[i] = (stateToIn[i] - stateFromIn[i])/incrementTotal;
+    
+    vector<double> stateCurr (stateFromIn, stateFromIn + numDimensions);
+    
+    if (!collisionCache) {
+        
+        for (int i = 0; i < numSegments; i++) {
+            
+            if (IsInCollision (&stateCurr[0]))  
+                return false;
+            
+            for (int i = 0; i < numDimensions; i++)
+                stateCurr[i] += dists[i];
+        }
+        
+        return !IsInCollision (stateToIn);
+    }
+    
+    // Same walk, keeping the depths to tell whether the whole key is decided:
+    // past a collision, on until the segment is quantum deep in the obstacle
+    double depthMin = 2.0*cacheQuantum;
+    for (int i = 0; i <= numSegments; i++) {
+        
+        double depth = getObstacleDepth ((i < numSegments) ? &stateCurr[0] : stateToIn, depthMin);
+        if (depth < depthMin)
+            depthMin = depth;
+        if (depthMin <= -cacheQuantum) {
+            collisionCache->insert (keyIn, false);
+            return false;
+        }
+        
+        for (int i = 0; i < numDimensions; i++)
+            stateCurr[i] += dists[i];
+    }
+    
+    if (depthMin > cacheQuantum)
+        collisionCache->insert (keyIn, true);
+    
+    return (depthMin > 0.0);
+}
+
+
 int System::sampleState (State &randomStateOut) {
     
     randomStateOut.setNumDimensions (numDimensions);
@@ -244,46 +500,50 @@ int System::sampleState (State &randomStateOut) {
 
 
 
-int System::extendTo (State &stateFromIn, State &stateTowardsIn, Trajectory &trajectoryOut, bool &exactConnectionOut) {
+int System::sampleGoalState (State &randomStateOut) {
     
-    double *dists = new double[numDimensions];
-    for (int i = 0; i < numDimensions; i++) 
-        dists[i] = stateTowardsIn.x[i] - stateFromIn.x[i];
-    
-    double distTotal = 0.0;
-    for (int i = 0; i < numDimensions; i++) 
-        distTotal += dists[i]*dists[i];
-    distTotal = sqrt (distTotal);
-    
-    double incrementTotal = distTotal/DISCRETIZATION_STEP;
+    randomStateOut.setNumDimensions (numDimensions);
     
-    // normalize the distance according to the disretization step
-    for (int i = 0; i < numDimensions; i++)
-        dists[i] /= incrementTotal;
+    for (int i = 0; i < numDimensions; i++) {
+        
+        randomStateOut.x[i] = (double)rand()/(RAND_MAX + 1.0)*regionGoal.size[i] 
+        - regionGoal.size[i]/2.0 + regionGoal.center[i];
+    }
     
-    int numSegments = (int)floor(incrementTotal);
+    if (IsInCollision (randomStateOut.x))
+        return 0;
     
-    double *stateCurr = new double[numDimensions];
-    for (int i = 0; i < numDimensions; i++) 
-        stateCurr[i] = stateFromIn.x[i];
+    return 1;
+}
+
+
+
+int System::extendTo (State &stateFromIn, State &stateTowardsIn, Trajectory &trajectoryOut, bool &exactConnectionOut) {
     
-    for (int i = 0; i < numSegments; i++) {
-        
-        if (IsInCollision (stateCurr))  
-            return 0;
-        
-        for (int i = 0; i < numDimensions; i++)
-            stateCurr[i] += dists[i];
+    double distTotal = 0.0;
+    for (int i = 0; i < numDimensions; i++) {
+        double distCurr = stateTowardsIn.x[i] - stateFromIn.x[i];
+        distTotal += distCurr*distCurr;
     }
+    distTotal = sqrt (distTotal);
     
-    if (IsInCollision (stateTowardsIn.x))
-        return 0;
+    // The result of a segment of the same key if cached, otherwise the check
+    unsigned long long key = collisionCache ? getSegmentKey (stateFromIn.x, stateTowardsIn.x) : 0;
+    int cached = collisionCache ? collisionCache->lookup (key) : -1;
+    if (cached >= 0)
+        numCacheHits++;
+    else if (collisionCache)
+        numCacheMisses++;
     
-    trajectoryOut.endState = new State (stateTowardsIn);
-    trajectoryOut.totalVariation = distTotal;
+    if ( (cached == 0) || ( (cached < 0) && !isSegmentFree (stateFromIn.x, stateTowardsIn.x, distTotal, key) ) )
+        return 0;
     
-    delete [] dists;
-    delete [] stateCurr;
+    // Reuse the end state of the trajectory if it already has one
+    if (trajectoryOut.endState)
+        *(trajectoryOut.endState) = stateTowardsIn;
+    else
+        trajectoryOut.endState = new State (stateTowardsIn);
+    trajectoryOut.totalVariation = evaluateSegmentCost (stateFromIn.x, stateTowardsIn.x, distTotal);
     
     exactConnectionOut = true;
     
@@ -302,7 +562,7 @@ double System::evaluateExtensionCost (State& stateFromIn, State& stateTowardsIn,
         distTotal += distCurr*distCurr;
     }
     
-    return sqrt(distTotal);
+    return evaluateSegmentCost (stateFromIn.x, stateTowardsIn.x, sqrt(distTotal));
     
 }
 
@@ -328,7 +588,7 @@ double System::evaluateCostToGo (State& stateIn) {
     
     double dist = 0.0;
     for (int i = 0; i < numDimensions; i++) 
-        dist += (stateIn[i] - regionGoal.center[i])*(stateIn[0] - regionGoal.center[i]);
+        dist += (stateIn[i] - regionGoal.center[i])*(stateIn[i] - regionGoal.center[i]);
     dist = sqrt(dist);
     
     return dist - radius;
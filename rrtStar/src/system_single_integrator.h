@@ -6,6 +6,9 @@
 #define __RRTS_SYSTEM_SINGLE_INTEGRATOR_H_
 
 #include <list>
+#include <vector>
+
+#include "collision_cache.h"
 
 
 
@@ -21,6 +24,10 @@ namespace SingleIntegrator {
         
         int numDimensions;
         
+        // Owns center and size, not copyable
+        region (const region&);
+        region& operator= (const region&);
+        
     public:    
         
         /*!
@@ -165,6 +172,27 @@ namespace SingleIntegrator {
          */
         Trajectory& operator= (const Trajectory& trajectoryIn);
         
+        /*!
+         * \brief Trajectory move constructor
+         *
+         * Takes over the end state of trajectoryIn without copying it.
+         *
+         * \param trajectoryIn The trajectory to be moved.
+         *
+         */
+        Trajectory (Trajectory&& trajectoryIn);
+        
+        /*!
+         * \brief Trajectory move assignment operator
+         *
+         * Swaps the end states, the one of this trajectory is released
+         * with trajectoryIn.
+         *
+         * \param trajectoryIn The trajectory to be moved.
+         *
+         */
+        Trajectory& operator= (Trajectory&& trajectoryIn);
+        
         /*!
          * \brief Returns a reference to the end state of this trajectory.
          *
@@ -200,8 +228,25 @@ namespace SingleIntegrator {
         
         int numDimensions;
         bool IsInCollision (double *stateIn);
+        double evaluateSegmentCost (double *stateFromIn, double *stateToIn, double distIn);
+        double getObstacleDepth (double *stateIn, double depthMaxIn);
+        unsigned long long getSegmentKey (double *stateFromIn, double *stateToIn);
+        bool isSegmentFree (double *stateFromIn, double *stateToIn, double distIn, unsigned long long keyIn);
         
         State rootState;
+        std::vector<double> goalState;
+        
+        int costCols;
+        int costRows;
+        std::vector<double> cellCosts;
+        
+        CollisionCache *collisionCache;
+        double cacheQuantum;
+        unsigned long long cacheVersion;
+        
+        // Owns the obstacles, not copyable
+        System (const System&);
+        System& operator= (const System&);
         
     public:    
         
@@ -222,10 +267,24 @@ namespace SingleIntegrator {
         /*!
          * \brief The list of all obstacles
          *
-         * More elaborate description
+         * The obstacles are owned by the system and deleted with it.
          */
         std::list<region*> obstacles;
         
+        /*!
+         * \brief Number of segments found in the collision cache
+         *
+         * More elaborate description
+         */
+        long numCacheHits;
+        
+        /*!
+         * \brief Number of segments checked for collision, not found in the cache
+         *
+         * More elaborate description
+         */
+        long numCacheMisses;
+        
         /*!
          * \brief System constructor
          *
@@ -242,6 +301,48 @@ namespace SingleIntegrator {
         
         int setNumDimensions (int numDimensionsIn);
         
+        /*!
+         * \brief Deletes all the obstacles
+         *
+         * More elaborate description
+         */
+        int clearObstacles ();
+        
+        /*!
+         * \brief Sets the cost map over the operating region
+         *
+         * The cost of a trajectory becomes its length plus the integral of
+         * the cell costs along it, so that paths keep away from costly
+         * cells (near obstacles, outside the pertinent area) rather than
+         * grazing them. The operating region must be set. Costs are taken
+         * in the first two dimensions; negative ones count as zero, so
+         * that the length stays a lower bound of the cost.
+         *
+         * \param colsIn Number of columns, zero to restore the length as cost
+         * \param rowsIn Number of rows
+         * \param costsIn Extra cost per unit length of each cell, row-major
+         *
+         */
+        int setCostMap (int colsIn, int rowsIn, const double *costsIn);
+        
+        /*!
+         * \brief Sets the cache of the collision checks of extendTo
+         *
+         * Segments are keyed by the cells of a quantumIn grid their end
+         * states lie in (in either order), and by a hash of the obstacles,
+         * so that the results stored for other obstacles are never used.
+         * The cache answers for a whole key only when it is sure to: a
+         * segment is stored free if it keeps quantumIn away from the
+         * obstacles along each axis, in collision if it enters them by
+         * quantumIn, and not stored otherwise. Cached results are then
+         * those of the check. Must be set after the obstacles.
+         *
+         * \param cacheIn The cache, owned by the caller and possibly shared, NULL for none
+         * \param quantumIn Size of the grid cells
+         *
+         */
+        int setCollisionCache (CollisionCache *cacheIn, double quantumIn);
+        
         /*!
          * \brief Returns the dimensionality of the Euclidean space.
          *
@@ -274,6 +375,40 @@ namespace SingleIntegrator {
          */
         bool isReachingTarget (State &stateIn);
         
+        /*!
+         * \brief Sets the goal state, where the paths end
+         *
+         * The goal region is then only where the paths may be connected
+         * to it from, the goal state need not be at its center.
+         *
+         * \param stateIn The goal state, an array of dimension getNumDimensions()
+         *
+         */
+        int setGoalState (double *stateIn);
+        
+        /*!
+         * \brief Returns the goal state, i.e., the root of the goal tree.
+         *
+         * The one set with setGoalState (), or else the center of the goal
+         * region. Paths end at it, and the bidirectional planner grows its
+         * goal tree from it. Returns zero if the goal state is in collision.
+         *
+         * \param goalStateOut
+         *
+         */
+        int getGoalState (State &goalStateOut);
+        
+        /*!
+         * \brief Returns a sample state from the goal region.
+         *
+         * Used by the planner to inject goal samples. Returns zero if the 
+         * sample is in collision.
+         *
+         * \param randomStateOut
+         *
+         */
+        int sampleGoalState (State &randomStateOut);
+        
         /*!
          * \brief Returns a sample state.
          *